@@ -0,0 +1,30 @@
+#include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Dummy callbacks for ic_bench, loaded alongside libIntervalCheck
+// bench_callback busy waits for IC_BENCH_COST microseconds to model the cost of a real check
+// bench_hang never returns, standing in for a probe stuck in a wedged driver
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_callback(void) {
+  static long cost_ns = -1;
+  if(cost_ns < 0) {
+    cost_ns = getenv("IC_BENCH_COST") ? (long)(atof(getenv("IC_BENCH_COST")) * 1000) : 0;
+  }
+
+  uint64_t end = now_ns() + cost_ns;
+  while(cost_ns > 0 && now_ns() < end);
+}
+
+void bench_hang(void) {
+  while(1) {
+    pause();
+  }
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Synthetic workload run by ic_bench, with and without IntervalCheck preloaded
+// Usage: ic_bench_workload compute|syscall|barrier seconds [threads]
+// Prints a single line of key=value results
+
+#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR IC Bench Workload: " str, ##args); \
+                                      exit(EXIT_FAILURE); } while(0)
+
+#define MAX_SAMPLES (1 << 22)
+
+static double run_seconds;
+static int thread_count = 4;
+
+// Iteration latencies in ns, recorded by the timing thread only
+static uint64_t *samples;
+static size_t sample_count = 0;
+static unsigned long eintr_count = 0;
+static volatile double sink;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record(uint64_t start, uint64_t end) {
+  if(sample_count < MAX_SAMPLES) {
+    samples[sample_count++] = end - start;
+  }
+}
+
+// A fixed step of floating point work, a couple of hundred microseconds
+static void compute_step() {
+  double x = 1.0;
+  for(int i=0; i<20000; i++) {
+    x = x * 1.0000001 + sqrt(x) * 1e-9;
+  }
+  sink = x;
+}
+
+static void run_compute(uint64_t end) {
+  uint64_t start = now_ns();
+  while(start < end) {
+    compute_step();
+    uint64_t stop = now_ns();
+    record(start, stop);
+    start = stop;
+  }
+}
+
+// Blocking system calls that an interval timer signal interrupts
+static void run_syscall(uint64_t end) {
+  int fds[2];
+  if(pipe(fds) != 0) {
+    EXIT_PRINT("pipe failed: %s\n", strerror(errno));
+  }
+  char buf[4096];
+  memset(buf, 'x', sizeof(buf));
+
+  uint64_t start = now_ns();
+  while(start < end) {
+    while(write(fds[1], buf, sizeof(buf)) == -1 && errno == EINTR) {
+      eintr_count++;
+    }
+    while(read(fds[0], buf, sizeof(buf)) == -1 && errno == EINTR) {
+      eintr_count++;
+    }
+
+    struct timespec request = { 0, 50000 };
+    struct timespec remaining;
+    while(nanosleep(&request, &remaining) == -1 && errno == EINTR) {
+      eintr_count++;
+      request = remaining;
+    }
+
+    uint64_t stop = now_ns();
+    record(start, stop);
+    start = stop;
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Threads compute a step then meet at a barrier, so a delay to any one thread delays them all
+static pthread_barrier_t barrier;
+static volatile int barrier_done = 0;
+
+static void *barrier_worker(void *arg) {
+  while(true) {
+    compute_step();
+    pthread_barrier_wait(&barrier);
+    // The timing thread decides when to stop between the two barriers
+    pthread_barrier_wait(&barrier);
+    if(barrier_done) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static void run_barrier(uint64_t end) {
+  pthread_barrier_init(&barrier, NULL, thread_count);
+  pthread_t threads[thread_count];
+  for(int i=1; i<thread_count; i++) {
+    pthread_create(&threads[i], NULL, barrier_worker, NULL);
+  }
+
+  uint64_t start = now_ns();
+  while(true) {
+    compute_step();
+    pthread_barrier_wait(&barrier);
+    uint64_t stop = now_ns();
+    record(start, stop);
+    start = stop;
+    barrier_done = stop >= end;
+    pthread_barrier_wait(&barrier);
+    if(barrier_done) {
+      break;
+    }
+  }
+
+  for(int i=1; i<thread_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+}
+
+static int compare_samples(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(double fraction) {
+  size_t index = (size_t)(fraction * (double)(sample_count - 1));
+  return samples[index];
+}
+
+int main(int argc, char **argv) {
+  if(argc < 3) {
+    fprintf(stderr, "Usage: %s compute|syscall|barrier seconds [threads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *workload = argv[1];
+  run_seconds = atof(argv[2]);
+  if(argc > 3) {
+    thread_count = atoi(argv[3]);
+  }
+  if(run_seconds <= 0 || thread_count < 1) {
+    EXIT_PRINT("Invalid arguments\n");
+  }
+
+  samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+  if(samples == NULL) {
+    EXIT_PRINT("Failed to allocate samples\n");
+  }
+
+  uint64_t begin = now_ns();
+  uint64_t end = begin + (uint64_t)(run_seconds * 1e9);
+  if(strcmp(workload, "compute") == 0) {
+    run_compute(end);
+  } else if(strcmp(workload, "syscall") == 0) {
+    run_syscall(end);
+  } else if(strcmp(workload, "barrier") == 0) {
+    run_barrier(end);
+  } else {
+    EXIT_PRINT("Unknown workload %s\n", workload);
+  }
+  double elapsed = (now_ns() - begin) * 1e-9;
+
+  if(sample_count == 0) {
+    EXIT_PRINT("No iterations completed\n");
+  }
+  qsort(samples, sample_count, sizeof(uint64_t), compare_samples);
+
+  printf("iterations=%zu rate=%.1f eintr=%lu p50=%llu p99=%llu p999=%llu max=%llu\n",
+         sample_count, sample_count / elapsed, eintr_count,
+         (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.99),
+         (unsigned long long)percentile(0.999), (unsigned long long)samples[sample_count-1]);
+
+  return 0;
+}
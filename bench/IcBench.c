@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Measure the overhead IntervalCheck adds to synthetic workloads
+// Each workload is run once without the library for a baseline, then preloaded with a dummy
+// callback for every combination of mode, interval and callback cost.
+// Usage: ic_bench [-t seconds] [-w workloads] [-m modes] [-i intervals] [-c costs_us] [-n threads]
+// Lists are comma separated, e.g. ic_bench -t 2 -w syscall -m signal,thread -i 10ms,1s -c 0,1000
+
+#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR IC Bench: " str, ##args); \
+                                      exit(EXIT_FAILURE); } while(0)
+
+#define MAX_LIST 16
+
+typedef struct {
+  unsigned long iterations;
+  double rate;
+  unsigned long eintr;
+  unsigned long long p50, p99, p999, max;
+} result_t;
+
+static int split(char *list, char **items) {
+  int count = 0;
+  char *item;
+  while((item = strsep(&list, ",")) && count < MAX_LIST) {
+    if(*item) {
+      items[count++] = item;
+    }
+  }
+  return count;
+}
+
+static result_t run(const char *environment, const char *workload, double seconds, int threads) {
+  char command[4096];
+  snprintf(command, sizeof(command), "env %s %s %s %g %d", environment, IC_BENCH_WORKLOAD, workload, seconds, threads);
+
+  FILE *output = popen(command, "r");
+  if(output == NULL) {
+    EXIT_PRINT("Failed to run %s\n", command);
+  }
+
+  result_t result;
+  memset(&result, 0, sizeof(result));
+  int fields = fscanf(output, "iterations=%lu rate=%lf eintr=%lu p50=%llu p99=%llu p999=%llu max=%llu",
+                      &result.iterations, &result.rate, &result.eintr, &result.p50, &result.p99,
+                      &result.p999, &result.max);
+  if(pclose(output) != 0 || fields != 7) {
+    EXIT_PRINT("Workload failed: %s\n", command);
+  }
+
+  return result;
+}
+
+static void print_row(const char *workload, const char *mode, const char *interval, const char *cost,
+                      const result_t *result, const result_t *baseline) {
+  printf("%-8s %-8s %-9s %-8s %10.1f %8.2f%% %8lu %10.1f %10.1f %10.1f\n", workload, mode, interval, cost,
+         result->rate, 100.0 * (baseline->rate / result->rate - 1.0), result->eintr,
+         result->p50 / 1e3, result->p99 / 1e3, result->max / 1e3);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 1.0;
+  int threads = 4;
+  char workload_list[256] = "compute,syscall,barrier";
+  char mode_list[256] = "signal,thread";
+  char interval_list[256] = "10ms,100ms,1s";
+  char cost_list[256] = "0,100,1000";
+
+  int opt;
+  while((opt = getopt(argc, argv, "t:w:m:i:c:n:")) != -1) {
+    switch(opt) {
+      case 't': seconds = atof(optarg); break;
+      case 'w': snprintf(workload_list, sizeof(workload_list), "%s", optarg); break;
+      case 'm': snprintf(mode_list, sizeof(mode_list), "%s", optarg); break;
+      case 'i': snprintf(interval_list, sizeof(interval_list), "%s", optarg); break;
+      case 'c': snprintf(cost_list, sizeof(cost_list), "%s", optarg); break;
+      case 'n': threads = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-t seconds] [-w workloads] [-m modes] [-i intervals] [-c costs_us] [-n threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  char *workloads[MAX_LIST], *modes[MAX_LIST], *intervals[MAX_LIST], *costs[MAX_LIST];
+  int workload_count = split(workload_list, workloads);
+  int mode_count = split(mode_list, modes);
+  int interval_count = split(interval_list, intervals);
+  int cost_count = split(cost_list, costs);
+
+  printf("%-8s %-8s %-9s %-8s %10s %9s %8s %10s %10s %10s\n", "workload", "mode", "interval", "cost_us",
+         "iter/s", "slowdown", "eintr", "p50_us", "p99_us", "max_us");
+
+  for(int w=0; w<workload_count; w++) {
+    result_t baseline = run("", workloads[w], seconds, threads);
+    print_row(workloads[w], "none", "-", "-", &baseline, &baseline);
+
+    for(int m=0; m<mode_count; m++) {
+      for(int i=0; i<interval_count; i++) {
+        for(int c=0; c<cost_count; c++) {
+          char environment[2048];
+          snprintf(environment, sizeof(environment),
+                   "LD_PRELOAD=%s:%s IC_MODE=%s IC_INTERVAL=%s IC_BENCH_COST=%s IC_CALLBACKS=bench_callback",
+                   IC_BENCH_LIBRARY, IC_BENCH_CALLBACKS, modes[m], intervals[i], costs[c]);
+          result_t result = run(environment, workloads[w], seconds, threads);
+          print_row(workloads[w], modes[m], intervals[i], costs[c], &result, &baseline);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,561 @@
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "IntervalCheckInternal.h"
+
+// Replay scenarios through the scheduler and plugins in virtual time
+// Built from the library sources with a virtual clock in place of CLOCK_MONOTONIC. Instead of
+// arming a timer the loop jumps straight to the next callback deadline or scripted action, so a
+// day of checks at production periods runs in milliseconds. A check marked with a latency
+// advances the clock by that much while it runs, as a slow probe would. A failed check ends the
+// scenario and is reported with its virtual time rather than killing the job.
+//
+// Each trace runs in its own forked process, from a fresh temporary directory that relative paths
+// are created in. Traces are read line by line, # starts a comment:
+//
+//   interval DURATION               Default period of the checks that follow (default 300s)
+//   plugin LIBRARY:CALLBACK[...]    Check loaded as with IC_PLUGINS, e.g. libFileProgress.so:file_progress@1m
+//   probe NAME[@period+delay][...]  Scripted check that returns its status after its latency
+//   setenv NAME VALUE               Set before any plugin is initialized
+//   at TIME [every PERIOD [until TIME]] ACTION
+//     write PATH BYTES [LINES]      Append BYTES bytes, LINES of them newlines
+//     truncate PATH                 Truncate to zero length
+//     rename PATH NEWPATH           Rename, as log rotation does, later writes to PATH create it anew
+//     latency NAME DURATION         Calls of check NAME take DURATION from now on
+//     status NAME ok|warn|fail      Status probe NAME returns from now on
+//     hang                          Mark the start of the fault detection latency is measured from
+//   end DURATION                    Length of the scenario (default 24h)
+//   expect none|detect [within DURATION]
+//
+// Usage: ic_replay [-v] TRACE...
+// Prints one row per trace and exits non zero if any expectation wasn't met or a replay didn't complete.
+
+#define REPLAY_START NSEC_PER_SEC
+#define MAX_ACTIONS 256
+#define MAX_LINE 1024
+
+typedef enum { ACTION_WRITE, ACTION_TRUNCATE, ACTION_RENAME, ACTION_LATENCY, ACTION_STATUS, ACTION_HANG } action_type_t;
+
+typedef struct {
+  action_type_t type;
+  uint64_t next;    // Virtual time of the next run
+  uint64_t every;   // 0 for a single run
+  uint64_t until;
+  char target[PATH_MAX];
+  char destination[PATH_MAX]; // New path of a rename
+  uint64_t value;   // Bytes, latency or status
+  uint64_t lines;
+} action_t;
+
+// Wraps the plugin of every entry, or stands in for a probe
+typedef struct {
+  const ic_plugin_v2_t *plugin; // NULL for a probe
+  void *data;
+  uint64_t latency;
+  ic_status_t status;
+} check_t;
+
+typedef enum { EXPECT_ANY, EXPECT_NONE, EXPECT_DETECT } expect_t;
+
+typedef struct {
+  bool detected;
+  bool met;            // Expectation met
+  uint64_t at;         // Virtual time of the detection, relative to the start
+  uint64_t hang;       // Time of the hang action, UINT64_MAX if there is none
+  uint64_t ticks;
+  char entry[IC_MAX_NAME_LENGTH];
+  char message[192];
+} result_t;
+
+static uint64_t virtual_now = REPLAY_START;
+static action_t actions[MAX_ACTIONS];
+static int action_count = 0;
+static check_t checks[MAX_CALLBACKS];
+static uint64_t end_time = 24*3600*NSEC_PER_SEC;
+static expect_t expect = EXPECT_ANY;
+static uint64_t expect_within = 0;
+static result_t result;
+static bool finished = false;
+
+static uint64_t replay_now(void) {
+  return virtual_now;
+}
+
+static ic_status_t check_tick(ic_tick_ctx_t *ctx) {
+  check_t *check = ctx->data;
+  ic_status_t status = check->status;
+  ctx->message = "scripted failure";
+  if(check->plugin) {
+    ctx->data = check->data;
+    status = check->plugin->tick(ctx);
+  }
+  virtual_now += check->latency;
+  return status;
+}
+
+static void check_finalize(void *data) {
+  check_t *check = data;
+  if(check->plugin && check->plugin->finalize) {
+    check->plugin->finalize(check->data);
+  }
+}
+
+static const ic_plugin_v2_t check_plugin = {
+  IC_PLUGIN_ABI_VERSION, "replay", NULL, check_tick, check_finalize
+};
+
+static void on_failure(const char *reason) {
+  result.detected = true;
+  result.at = virtual_now - REPLAY_START;
+  for(int i=0; i<ic_entry_count; i++) {
+    if(ic_entries[i].status == IC_STATUS_FAIL) {
+      snprintf(result.entry, sizeof(result.entry), "%s", ic_entries[i].name);
+      snprintf(result.message, sizeof(result.message), "%s", ic_entries[i].message ? ic_entries[i].message : reason);
+      break;
+    }
+  }
+  finished = true;
+}
+
+static void parse_error(const char *path, int line, const char *str) {
+  fprintf(stderr, "ERROR IC Replay: %s:%d: %s\n", path, line, str);
+  exit(EXIT_FAILURE);
+}
+
+static uint64_t duration(const char *path, int line, const char *str) {
+  uint64_t ns;
+  if(str == NULL || !ic_parse_duration(str, &ns)) {
+    parse_error(path, line, "expected a duration");
+  }
+  return ns;
+}
+
+static ic_entry_t *find_entry(const char *name) {
+  for(int i=0; i<ic_entry_count; i++) {
+    if(strcmp(ic_entries[i].name, name) == 0) {
+      return &ic_entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void parse_action(const char *path, int line, const char *time, char **save) {
+  if(action_count == MAX_ACTIONS) {
+    parse_error(path, line, "too many actions");
+  }
+  action_t *action = &actions[action_count];
+  memset(action, 0, sizeof(*action));
+  action->next = REPLAY_START + duration(path, line, time);
+  action->until = UINT64_MAX;
+
+  char *word = strtok_r(NULL, " \t", save);
+  if(word && strcmp(word, "every") == 0) {
+    action->every = duration(path, line, strtok_r(NULL, " \t", save));
+    if(action->every == 0) {
+      parse_error(path, line, "every must be greater than zero");
+    }
+    word = strtok_r(NULL, " \t", save);
+    if(word && strcmp(word, "until") == 0) {
+      action->until = REPLAY_START + duration(path, line, strtok_r(NULL, " \t", save));
+      word = strtok_r(NULL, " \t", save);
+    }
+  }
+  if(word == NULL) {
+    parse_error(path, line, "expected an action");
+  }
+
+  char *target = NULL, *value = NULL;
+  if(strcmp(word, "hang") == 0) {
+    action->type = ACTION_HANG;
+  } else {
+    target = strtok_r(NULL, " \t", save);
+    value = strtok_r(NULL, " \t", save);
+    if(target == NULL) {
+      parse_error(path, line, "expected a target");
+    }
+    snprintf(action->target, sizeof(action->target), "%s", target);
+    if(strcmp(word, "write") == 0) {
+      action->type = ACTION_WRITE;
+      if(value == NULL) {
+        parse_error(path, line, "expected a byte count");
+      }
+      action->value = strtoull(value, NULL, 0);
+      char *lines = strtok_r(NULL, " \t", save);
+      action->lines = lines ? strtoull(lines, NULL, 0) : 0;
+      if(action->lines > action->value) {
+        parse_error(path, line, "more lines than bytes");
+      }
+    } else if(strcmp(word, "truncate") == 0) {
+      action->type = ACTION_TRUNCATE;
+    } else if(strcmp(word, "rename") == 0) {
+      action->type = ACTION_RENAME;
+      if(value == NULL) {
+        parse_error(path, line, "expected a new path");
+      }
+      snprintf(action->destination, sizeof(action->destination), "%s", value);
+    } else if(strcmp(word, "latency") == 0) {
+      action->type = ACTION_LATENCY;
+      action->value = duration(path, line, value);
+    } else if(strcmp(word, "status") == 0) {
+      action->type = ACTION_STATUS;
+      if(value && strcmp(value, "ok") == 0) {
+        action->value = IC_STATUS_OK;
+      } else if(value && strcmp(value, "warn") == 0) {
+        action->value = IC_STATUS_WARN;
+      } else if(value && strcmp(value, "fail") == 0) {
+        action->value = IC_STATUS_FAIL;
+      } else {
+        parse_error(path, line, "expected ok, warn or fail");
+      }
+    } else {
+      parse_error(path, line, "unknown action");
+    }
+  }
+  action_count++;
+}
+
+static void parse_trace(const char *path) {
+  FILE *trace = fopen(path, "r");
+  if(trace == NULL) {
+    fprintf(stderr, "ERROR IC Replay: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t interval = 300*NSEC_PER_SEC;
+  char buffer[MAX_LINE];
+  for(int line=1; fgets(buffer, sizeof(buffer), trace); line++) {
+    buffer[strcspn(buffer, "#\r\n")] = '\0';
+    char *save;
+    char *keyword = strtok_r(buffer, " \t", &save);
+    if(keyword == NULL) {
+      continue;
+    }
+    char *argument = strtok_r(NULL, " \t", &save);
+
+    if(strcmp(keyword, "interval") == 0) {
+      interval = duration(path, line, argument);
+    } else if(strcmp(keyword, "plugin") == 0 || strcmp(keyword, "probe") == 0) {
+      if(argument == NULL) {
+        parse_error(path, line, "expected a check");
+      }
+      char *library = NULL;
+      if(keyword[1] == 'l') {
+        char *separator = strrchr(argument, ':');
+        if(separator == NULL || separator == argument) {
+          parse_error(path, line, "expected library:callback");
+        }
+        *separator = '\0';
+        library = argument;
+        argument = separator + 1;
+      }
+      ic_entry_t *entry = ic_add_entry(argument, interval);
+      if(entry->isolate || entry->lazy) {
+        parse_error(path, line, "!isolate and !lazy can't be replayed");
+      }
+      if(library) {
+        // Resolved now as the scenario runs from its own directory
+        char resolved[PATH_MAX];
+        entry->library = strdup(strchr(library, '/') && realpath(library, resolved) ? resolved : library);
+      } else {
+        entry->plugin = &check_plugin;
+        entry->plugin_data = &checks[entry - ic_entries];
+      }
+    } else if(strcmp(keyword, "setenv") == 0) {
+      char *value = strtok_r(NULL, "", &save);
+      if(argument == NULL) {
+        parse_error(path, line, "expected a variable");
+      }
+      setenv(argument, value ? value : "", 1);
+    } else if(strcmp(keyword, "at") == 0) {
+      parse_action(path, line, argument, &save);
+    } else if(strcmp(keyword, "end") == 0) {
+      end_time = duration(path, line, argument);
+    } else if(strcmp(keyword, "expect") == 0) {
+      if(argument && strcmp(argument, "none") == 0) {
+        expect = EXPECT_NONE;
+      } else if(argument && strcmp(argument, "detect") == 0) {
+        expect = EXPECT_DETECT;
+        char *within = strtok_r(NULL, " \t", &save);
+        if(within && strcmp(within, "within") == 0) {
+          expect_within = duration(path, line, strtok_r(NULL, " \t", &save));
+        }
+      } else {
+        parse_error(path, line, "expected none or detect");
+      }
+    } else {
+      parse_error(path, line, "unknown keyword");
+    }
+  }
+  fclose(trace);
+
+  for(int i=0; i<action_count; i++) {
+    if((actions[i].type == ACTION_LATENCY || actions[i].type == ACTION_STATUS) && find_entry(actions[i].target) == NULL) {
+      fprintf(stderr, "ERROR IC Replay: %s: no check named %s\n", path, actions[i].target);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void write_bytes(const char *path, uint64_t bytes, uint64_t lines) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if(fd == -1) {
+    fprintf(stderr, "ERROR IC Replay: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // Newlines are spread evenly, each ending a line of text
+  char buffer[4096];
+  uint64_t spacing = lines ? bytes / lines : 0;
+  for(uint64_t written=0; written<bytes;) {
+    size_t count = bytes - written < sizeof(buffer) ? (size_t)(bytes - written) : sizeof(buffer);
+    for(size_t i=0; i<count; i++) {
+      uint64_t offset = written + i;
+      buffer[i] = lines && (offset + 1) % spacing == 0 && (offset + 1) / spacing <= lines ? '\n' : 'x';
+    }
+    if(write(fd, buffer, count) != (ssize_t)count) {
+      fprintf(stderr, "ERROR IC Replay: %s: %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    written += count;
+  }
+  close(fd);
+}
+
+static void run_action(action_t *action) {
+  switch(action->type) {
+    case ACTION_WRITE:
+      write_bytes(action->target, action->value, action->lines);
+      break;
+    case ACTION_TRUNCATE:
+      if(truncate(action->target, 0) != 0 && errno != ENOENT) {
+        fprintf(stderr, "ERROR IC Replay: %s: %s\n", action->target, strerror(errno));
+      }
+      break;
+    case ACTION_RENAME:
+      if(rename(action->target, action->destination) != 0) {
+        fprintf(stderr, "ERROR IC Replay: %s: %s\n", action->target, strerror(errno));
+      }
+      break;
+    case ACTION_LATENCY:
+      checks[find_entry(action->target) - ic_entries].latency = action->value;
+      break;
+    case ACTION_STATUS:
+      checks[find_entry(action->target) - ic_entries].status = (ic_status_t)action->value;
+      break;
+    case ACTION_HANG:
+      if(result.hang == UINT64_MAX) {
+        result.hang = virtual_now - REPLAY_START;
+      }
+      break;
+  }
+
+  if(action->every > 0 && action->next + action->every <= action->until) {
+    action->next += action->every;
+  } else {
+    action->next = UINT64_MAX;
+  }
+}
+
+static uint64_t next_action() {
+  uint64_t next = UINT64_MAX;
+  for(int i=0; i<action_count; i++) {
+    if(actions[i].next < next) {
+      next = actions[i].next;
+    }
+  }
+  return next;
+}
+
+// Run the scenario to its end or first failure
+static void simulate() {
+  ic_set_clock(replay_now);
+  ic_failure_handler = on_failure;
+
+  // Actions due at the start, such as the first write, run before any plugin looks at the files
+  for(int i=0; i<action_count; i++) {
+    if(actions[i].next == REPLAY_START) {
+      run_action(&actions[i]);
+    }
+  }
+
+  ic_plugins_init();
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    // A check that failed to load or initialize would leave the scenario to pass without it
+    if(entry->disabled && !finished) {
+      fprintf(stderr, "ERROR IC Replay: %s could not be initialized\n", entry->name);
+      _exit(EXIT_FAILURE);
+    }
+    if(entry->plugin && entry->plugin != &check_plugin) {
+      checks[i].plugin = entry->plugin;
+      checks[i].data = entry->plugin_data;
+      entry->plugin = &check_plugin;
+      entry->plugin_data = &checks[i];
+    }
+  }
+  ic_schedule_start(virtual_now);
+
+  uint64_t end = REPLAY_START + end_time;
+  while(!finished) {
+    uint64_t deadline = ic_next_deadline();
+    uint64_t action = next_action();
+    uint64_t next = deadline < action ? deadline : action;
+    if(next > end) {
+      break;
+    }
+    if(next > virtual_now) {
+      virtual_now = next;
+    }
+
+    // Actions first, so that a write at the same time as a check is seen by it
+    for(int i=0; i<action_count; i++) {
+      while(actions[i].next <= virtual_now) {
+        run_action(&actions[i]);
+      }
+    }
+    if(ic_next_deadline() <= virtual_now) {
+      ic_run_due(virtual_now);
+    }
+  }
+
+  for(int i=0; i<ic_entry_count; i++) {
+    result.ticks += ic_entries[i].ticks;
+  }
+  ic_plugins_finalize();
+
+  if(expect == EXPECT_NONE) {
+    result.met = !result.detected;
+  } else if(expect == EXPECT_DETECT) {
+    uint64_t from = result.hang == UINT64_MAX ? 0 : result.hang;
+    result.met = result.detected && result.at >= from && (expect_within == 0 || result.at - from <= expect_within);
+  } else {
+    result.met = true;
+  }
+}
+
+// Replay one trace in a child process, which starts from clean library and plugin state
+static bool replay(const char *path, bool verbose, result_t *out) {
+  int fds[2];
+  if(pipe(fds) != 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  char trace[PATH_MAX];
+  if(realpath(path, trace) == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  // The child would otherwise repeat anything still buffered
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    if(!verbose) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+
+    // Library paths are resolved against the caller's directory, files against the scenario's
+    memset(&result, 0, sizeof(result));
+    result.hang = UINT64_MAX;
+    parse_trace(trace);
+    char directory[] = "/tmp/ic_replay.XXXXXX";
+    if(mkdtemp(directory) == NULL || chdir(directory) != 0) {
+      _exit(EXIT_FAILURE);
+    }
+    simulate();
+    fflush(stdout);
+    if(write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+      _exit(EXIT_FAILURE);
+    }
+
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    if(system(command) != 0) {
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(fds[1]);
+  bool complete = read(fds[0], out, sizeof(*out)) == sizeof(*out);
+  close(fds[0]);
+  int status;
+  if(waitpid(pid, &status, 0) == -1) {
+    perror("waitpid");
+    exit(EXIT_FAILURE);
+  }
+
+  // A child that crashed after writing its result, such as in a plugin's destructor, is an error
+  if(complete && !(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)) {
+    if(WIFSIGNALED(status)) {
+      fprintf(stderr, "ERROR IC Replay: %s: replay killed by signal %d\n", path, WTERMSIG(status));
+    } else {
+      fprintf(stderr, "ERROR IC Replay: %s: replay exited with status %d\n", path, WEXITSTATUS(status));
+    }
+    complete = false;
+  }
+  return complete;
+}
+
+int main(int argc, char **argv) {
+  bool verbose = false;
+  int opt;
+  while((opt = getopt(argc, argv, "vh")) != -1) {
+    if(opt == 'v') {
+      verbose = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-v] TRACE...\nReplay scenarios through IntervalCheck and its plugins in virtual time\n", argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if(optind == argc) {
+    fprintf(stderr, "Usage: %s [-v] TRACE...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int unmet = 0;
+  printf("%-32s %-9s %12s %12s %12s %8s %-16s %s\n", "trace", "result", "at_s", "hang_s", "latency_s", "ticks", "check", "message");
+  for(int i=optind; i<argc; i++) {
+    result_t r;
+    const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+    if(!replay(argv[i], verbose, &r)) {
+      printf("%-32s %-9s\n", name, "error");
+      unmet++;
+      continue;
+    }
+    unmet += !r.met;
+
+    char at[32] = "-", hang[32] = "-", latency[32] = "-";
+    if(r.detected) {
+      snprintf(at, sizeof(at), "%.3f", (double)r.at/NSEC_PER_SEC);
+    }
+    if(r.hang != UINT64_MAX) {
+      snprintf(hang, sizeof(hang), "%.3f", (double)r.hang/NSEC_PER_SEC);
+      if(r.detected && r.at >= r.hang) {
+        snprintf(latency, sizeof(latency), "%.3f", (double)(r.at - r.hang)/NSEC_PER_SEC);
+      }
+    }
+    printf("%-32s %-9s %12s %12s %12s %8llu %-16s %s\n", name, r.met ? (r.detected ? "detected" : "ok") : "UNMET", at, hang,
+           latency, (unsigned long long)r.ticks, r.detected ? r.entry : "-", r.detected ? r.message : "");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  printf("# %d traces in %.3fs, %d unmet\n", argc - optind,
+         (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec)/1e9, unmet);
+
+  return unmet ? EXIT_FAILURE : EXIT_SUCCESS;
+}
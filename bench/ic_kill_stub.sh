@@ -0,0 +1,5 @@
+#!/bin/sh
+# Stand in for a resource manager's job termination, for IC_KILL_BACKEND=script
+# Logs the request and kills the monitored process, IC_KILL_PID, as a job wide kill would
+echo "IC KILL STUB: $(date +%s.%N) killing $IC_KILL_PID: $1" >&2
+kill -KILL "$IC_KILL_PID"
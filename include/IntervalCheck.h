@@ -0,0 +1,122 @@
+#ifndef INTERVAL_CHECK_H
+#define INTERVAL_CHECK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Application progress counters checked by IntervalCheck
+//
+// ic_heartbeat(id) increments counter id and ic_progress(id, value) sets it. Each thread updates
+// its own cache line with a relaxed atomic store so both are cheap enough for the innermost loop.
+// With IC_HEARTBEAT_TIMEOUT set a counter that has been used and then stops changing for longer
+// than the timeout is treated as a hang.
+//
+// The functions are declared weak and the macros below only call them when libIntervalCheck is
+// loaded, so codes can be built with them unconditionally and run without IntervalCheck.
+
+#define IC_MAX_COUNTERS 8
+
+void ic_heartbeat(int counter_id) __attribute__((weak));
+void ic_progress(int counter_id, uint64_t value) __attribute__((weak));
+
+#define ic_heartbeat(counter_id) do { if(ic_heartbeat) ic_heartbeat(counter_id); } while(0)
+#define ic_progress(counter_id, value) do { if(ic_progress) ic_progress(counter_id, value); } while(0)
+
+// ic_heartbeat_totals(totals) sums each counter of this process over its threads, for plugins that
+// judge progress themselves. Take the address first as with ic_kill_job.
+
+void ic_heartbeat_totals(uint64_t totals[IC_MAX_COUNTERS]) __attribute__((weak));
+
+// ic_monitoring_self() returns non zero if the calling process is the monitored application, and
+// zero in the helper of an !isolate check or in icd. Plugins that sample their own process, e.g.
+// through /proc/self, should disable themselves when it returns zero. Take the address first, the
+// callbacks of versions without it always run in the application.
+
+int ic_monitoring_self(void) __attribute__((weak));
+
+// Job termination
+//
+// ic_kill_job(reason) ends the whole job through the backend selected by IC_KILL_BACKEND and never
+// returns. Plugins should take the address first, it is declared weak so they still load without
+// IntervalCheck or with versions that predate it.
+
+void ic_kill_job(const char *reason) __attribute__((weak, noreturn));
+
+// Event log
+//
+// With IC_EVENT_LOG set the monitoring process records fixed size binary events in a ring buffer
+// that a background thread appends to the log file, ic_events decodes it. ic_event(type, id,
+// status, value) records an event from a plugin or the application. It takes no locks and only
+// reads the clock so it is safe in a signal handler, events are dropped if the ring is full.
+
+typedef enum {
+  IC_EVENT_PROCESS = 1,     // First record of each process, status: log version, value: CLOCK_REALTIME
+  IC_EVENT_NAME,            // id: callback, value: name length, the name follows in raw records
+  IC_EVENT_DROPPED,         // value: events lost as the ring was full
+  IC_EVENT_DISPATCH,        // id: callback, value: lateness relative to its deadline
+  IC_EVENT_SKIP,            // id: callback, the previous call was still running
+  IC_EVENT_TICK_START,      // id: callback, value: time waiting for a worker
+  IC_EVENT_TICK_END,        // id: callback, status: ic_status_t, value: execution time
+  IC_EVENT_OVERRUN,         // id: callback, value: running time
+  IC_EVENT_PERIOD,          // id: callback, value: new adaptive period
+  IC_EVENT_HELPER_KILLED,   // id: callback, value: pid of the unresponsive helper
+  IC_EVENT_ALIVE,           // value: monitored processes alive
+  IC_EVENT_LEADER,          // value: pid of the new node leader
+  IC_EVENT_KILL_JOB,        // status: 1 if the termination request succeeded, value: time taken
+
+  // Events recorded by the bundled plugins
+  IC_EVENT_WATCHDOG_ARM = 64, // id: device, value: timeout
+  IC_EVENT_WATCHDOG_DISARM,   // id: device, value: time armed
+  IC_EVENT_FILE_BYTES,        // id: file, value: size of the file
+  IC_EVENT_FILE_LINES,        // id: file, value: lines in the file
+  IC_EVENT_FILE_IDLE,         // id: file, value: time since the file was modified
+  IC_EVENT_NVML_REOPEN,       // id: device, status: NVML error of the failed query, value: NVML error reopening
+
+  // First type free for applications and other plugins
+  IC_EVENT_USER = 128
+} ic_event_type_t;
+
+void ic_event(uint16_t type, uint16_t id, uint32_t status, uint64_t value) __attribute__((weak));
+
+#define ic_event(type, id, status, value) do { if(ic_event) ic_event(type, id, status, value); } while(0)
+
+// Plugin interface
+//
+// A plugin exports an ic_plugin_v2_t named <callback>_plugin, e.g. file_progress_plugin for
+// IC_CALLBACKS=file_progress. init runs once when monitoring starts, outside of the timer path,
+// tick runs on every period and finalize runs when monitoring stops. A plain void <callback>(void)
+// function is still accepted when no descriptor is found.
+
+#define IC_PLUGIN_ABI_VERSION 2
+
+typedef enum {
+  IC_STATUS_OK = 0,  // Check passed
+  IC_STATUS_WARN,    // Report the message and carry on
+  IC_STATUS_FAIL,    // The job is unhealthy and is terminated
+  IC_STATUS_DISABLE  // The check can't run in this process, stop calling it
+} ic_status_t;
+
+typedef struct {
+  uint64_t now;        // CLOCK_MONOTONIC time the tick was dispatched in nanoseconds
+  uint64_t tick;       // Number of earlier ticks of this plugin
+  uint64_t period;     // Current period in nanoseconds
+  void *data;          // Value set by init
+  const char *message; // Set by tick to explain a status other than IC_STATUS_OK
+} ic_tick_ctx_t;
+
+typedef struct {
+  uint32_t abi_version; // IC_PLUGIN_ABI_VERSION
+  const char *name;
+  ic_status_t (*init)(void **data);           // Optional, a status other than OK stops the plugin
+  ic_status_t (*tick)(ic_tick_ctx_t *ctx);
+  void (*finalize)(void *data);               // Optional
+} ic_plugin_v2_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "LineCount.h"
+
+// Compare the bytes/sec of the original fgetc line count against the incremental SIMD counter
+// Usage: fp_line_count_bench [file_megabytes] [append_megabytes]
+
+#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR Line Count Bench: " str, ##args); \
+                                      exit(EXIT_FAILURE); } while(0)
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The line count FileProgress performed on every tick before LineCount.c
+static long long fgetc_lines(const char* file_name) {
+  FILE *file = fopen(file_name, "r");
+  if(file == NULL) {
+    EXIT_PRINT("Error opening %s: %s\n", file_name, strerror(errno));
+  }
+  int c;
+  long long new_lines = 0;
+  do {
+    c = fgetc(file);
+    if(c == '\n') {
+      new_lines++;
+    }
+  } while(c != EOF);
+  fclose(file);
+
+  return new_lines;
+}
+
+// Fill buf with log like lines of varying length
+static void fill_lines(char *buf, size_t len) {
+  unsigned int seed = 42;
+  size_t line_left = 0;
+  for(size_t i=0; i<len; i++) {
+    if(line_left == 0) {
+      buf[i] = '\n';
+      line_left = 1 + rand_r(&seed) % 160;
+    } else {
+      buf[i] = 'a' + i % 26;
+      line_left--;
+    }
+  }
+}
+
+static void append_file(const char *file_name, const char *buf, size_t len) {
+  int fd = open(file_name, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+  if(fd == -1) {
+    EXIT_PRINT("Error opening %s: %s\n", file_name, strerror(errno));
+  }
+  size_t written = 0;
+  while(written < len) {
+    ssize_t ret = write(fd, buf + written, len - written);
+    if(ret == -1) {
+      EXIT_PRINT("Error writing %s: %s\n", file_name, strerror(errno));
+    }
+    written += ret;
+  }
+  close(fd);
+}
+
+static void report(const char *name, size_t bytes, double seconds, long long lines) {
+  printf("%-28s %10.1f MB/s %12lld lines %10.3f ms\n", name, bytes / seconds / 1e6, lines, seconds * 1e3);
+}
+
+static void bench_memory(const char *name, size_t (*count)(const char*, size_t), const char *buf, size_t len) {
+  const int repeats = 5;
+  size_t lines = 0;
+  double start = now_seconds();
+  for(int i=0; i<repeats; i++) {
+    lines = count(buf, len);
+  }
+  double elapsed = now_seconds() - start;
+  report(name, len * repeats, elapsed, (long long)lines);
+}
+
+int main(int argc, char **argv) {
+  size_t file_mb = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+  size_t append_mb = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+  size_t file_bytes = file_mb * 1024 * 1024;
+  size_t append_bytes = append_mb * 1024 * 1024;
+
+  char file_name[] = "/tmp/fp_line_count_bench.XXXXXX";
+  int fd = mkstemp(file_name);
+  if(fd == -1) {
+    EXIT_PRINT("Error creating temporary file: %s\n", strerror(errno));
+  }
+  close(fd);
+
+  char *buf = malloc(file_bytes);
+  if(buf == NULL) {
+    EXIT_PRINT("Failed to allocate %zu bytes\n", file_bytes);
+  }
+  fill_lines(buf, file_bytes);
+
+  printf("In memory newline counting, %zu MB\n", file_mb);
+  bench_memory("scalar (memchr)", fp_count_newlines_scalar, buf, file_bytes);
+#ifdef FP_HAVE_X86_SIMD
+  bench_memory("sse2", fp_count_newlines_sse2, buf, file_bytes);
+  if(fp_cpu_has_avx2()) {
+    bench_memory("avx2", fp_count_newlines_avx2, buf, file_bytes);
+  }
+#endif
+
+  append_file(file_name, buf, file_bytes);
+
+  printf("\nFile line counting, %zu MB file with %zu MB appended per tick\n", file_mb, append_mb);
+
+  double start = now_seconds();
+  long long lines = fgetc_lines(file_name);
+  report("fgetc full scan", file_bytes, now_seconds() - start, lines);
+
+  fp_line_counter_t counter;
+  fp_line_counter_init(&counter);
+  start = now_seconds();
+  lines = fp_line_counter_update(&counter, file_name);
+  report("incremental first scan", file_bytes, now_seconds() - start, lines);
+
+  // Each tick the original implementation rescans the whole file, the counter only the appended bytes
+  append_file(file_name, buf, append_bytes);
+  start = now_seconds();
+  lines = fgetc_lines(file_name);
+  report("fgetc tick", file_bytes + append_bytes, now_seconds() - start, lines);
+
+  append_file(file_name, buf, append_bytes);
+  start = now_seconds();
+  lines = fp_line_counter_update(&counter, file_name);
+  double elapsed = now_seconds() - start;
+  // Report throughput relative to the file size as that's the work the fgetc tick had to do
+  report("incremental tick (effective)", file_bytes + 2 * append_bytes, elapsed, lines);
+
+  fp_line_counter_close(&counter);
+  unlink(file_name);
+  free(buf);
+
+  return 0;
+}
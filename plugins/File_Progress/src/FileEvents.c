@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "FileEvents.h"
+
+// Filesystems where writes from other nodes don't generate local inotify events
+static const long remote_filesystems[] = {
+  0x6969,     // NFS
+  0x0BD00BD0, // Lustre
+  0x47504653, // GPFS
+  0xFF534D42, // CIFS
+  0xFE534D42, // SMB2
+  0x65735546, // FUSE
+  0x00C36400, // Ceph
+  0xAAD7AAEA, // PanFS
+};
+
+// Shared inotify instance and watcher thread
+static int inotify_fd = -1;
+static int wake_fd = -1;
+static pthread_t watcher;
+static bool watcher_running = false;
+
+// Watched files, the lock protects the list and the watch/fd of each entry
+static pthread_mutex_t watched_lock = PTHREAD_MUTEX_INITIALIZER;
+static fp_file_events_t **watched = NULL;
+static int watched_count = 0;
+static int watched_capacity = 0;
+
+uint64_t fp_monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool is_remote_filesystem(int fd) {
+  struct statfs fs;
+  if(fstatfs(fd, &fs) != 0) {
+    return true;
+  }
+  for(size_t i=0; i<sizeof(remote_filesystems)/sizeof(remote_filesystems[0]); i++) {
+    if((long)fs.f_type == remote_filesystems[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void record_write(fp_file_events_t *events) {
+  struct stat st;
+  if(fstat(events->fd, &st) == 0) {
+    atomic_store_explicit(&events->bytes, (long long)st.st_size, memory_order_relaxed);
+  }
+  atomic_store_explicit(&events->last_write, fp_monotonic_ns(), memory_order_release);
+}
+
+// Open the file and add an inotify watch for it
+static bool watch_file(fp_file_events_t *events) {
+  events->fd = open(events->file_name, O_RDONLY | O_CLOEXEC);
+  if(events->fd == -1) {
+    return false;
+  }
+
+  if(is_remote_filesystem(events->fd)) {
+    close(events->fd);
+    events->fd = -1;
+    return false;
+  }
+
+  events->watch = inotify_add_watch(inotify_fd, events->file_name, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+  if(events->watch == -1) {
+    close(events->fd);
+    events->fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+static void unwatch_file(fp_file_events_t *events) {
+  if(events->watch != -1) {
+    inotify_rm_watch(inotify_fd, events->watch);
+    events->watch = -1;
+  }
+  if(events->fd != -1) {
+    close(events->fd);
+    events->fd = -1;
+  }
+}
+
+// Must be called with watched_lock held
+static fp_file_events_t *find_watch(int watch) {
+  for(int i=0; i<watched_count; i++) {
+    if(watched[i]->watch == watch) {
+      return watched[i];
+    }
+  }
+  return NULL;
+}
+
+static void handle_event(const struct inotify_event *event) {
+  pthread_mutex_lock(&watched_lock);
+
+  fp_file_events_t *events = find_watch(event->wd);
+  if(events && atomic_load(&events->active)) {
+    // The file was rotated or removed, follow the path to the new file if there is one
+    if(event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+      unwatch_file(events);
+      if(watch_file(events)) {
+        record_write(events);
+      } else {
+        atomic_store(&events->active, false);
+      }
+    } else if(event->mask & IN_MODIFY) {
+      record_write(events);
+    }
+  }
+
+  pthread_mutex_unlock(&watched_lock);
+}
+
+static void *watch_main(void *arg) {
+  setpriority(PRIO_PROCESS, 0, 19);
+
+  struct pollfd fds[2];
+  fds[0].fd = inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake_fd;
+  fds[1].events = POLLIN;
+
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while(true) {
+    if(poll(fds, 2, -1) == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if(fds[1].revents & POLLIN) {
+      break;
+    }
+
+    ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+    if(len <= 0) {
+      continue;
+    }
+
+    for(char *p = buffer; p < buffer + len; ) {
+      struct inotify_event *event = (struct inotify_event*)p;
+      handle_event(event);
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  return NULL;
+}
+
+static bool start_watcher() {
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  if(inotify_fd == -1) {
+    return false;
+  }
+
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+  if(wake_fd == -1) {
+    close(inotify_fd);
+    inotify_fd = -1;
+    return false;
+  }
+
+  // Keep application signals away from the watcher thread
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  int err = pthread_create(&watcher, NULL, watch_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if(err != 0) {
+    close(inotify_fd);
+    close(wake_fd);
+    inotify_fd = -1;
+    wake_fd = -1;
+    return false;
+  }
+
+  watcher_running = true;
+  return true;
+}
+
+bool fp_file_events_add(fp_file_events_t *events, const char *file_name) {
+  memset(events, 0, sizeof(*events));
+  events->file_name = file_name;
+  events->watch = -1;
+  events->fd = -1;
+  atomic_init(&events->active, false);
+
+  if(!watcher_running && !start_watcher()) {
+    return false;
+  }
+
+  pthread_mutex_lock(&watched_lock);
+
+  if(watched_count == watched_capacity) {
+    int capacity = watched_capacity ? 2*watched_capacity : 16;
+    fp_file_events_t **grown = realloc(watched, capacity * sizeof(*watched));
+    if(grown == NULL) {
+      pthread_mutex_unlock(&watched_lock);
+      return false;
+    }
+    watched = grown;
+    watched_capacity = capacity;
+  }
+
+  bool watching = watch_file(events);
+  if(watching) {
+    record_write(events);
+    atomic_store(&events->active, true);
+    watched[watched_count++] = events;
+  }
+
+  pthread_mutex_unlock(&watched_lock);
+
+  return watching;
+}
+
+void fp_file_events_stop(void) {
+  if(!watcher_running) {
+    return;
+  }
+
+  uint64_t wake = 1;
+  if(write(wake_fd, &wake, sizeof(wake)) == sizeof(wake)) {
+    pthread_join(watcher, NULL);
+  }
+  watcher_running = false;
+
+  pthread_mutex_lock(&watched_lock);
+  for(int i=0; i<watched_count; i++) {
+    atomic_store(&watched[i]->active, false);
+    unwatch_file(watched[i]);
+  }
+  watched_count = 0;
+  pthread_mutex_unlock(&watched_lock);
+
+  close(inotify_fd);
+  close(wake_fd);
+  inotify_fd = -1;
+  wake_fd = -1;
+}
+
+bool fp_file_events_confirm(fp_file_events_t *events) {
+  if(!atomic_load(&events->active)) {
+    return false;
+  }
+
+  pthread_mutex_lock(&watched_lock);
+  struct stat st;
+  bool confirmed = true;
+  if(events->fd != -1 && fstat(events->fd, &st) == 0 &&
+     (long long)st.st_size != atomic_load(&events->bytes)) {
+    atomic_store(&events->active, false);
+    confirmed = false;
+  }
+  pthread_mutex_unlock(&watched_lock);
+
+  return confirmed;
+}
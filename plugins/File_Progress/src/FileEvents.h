@@ -0,0 +1,34 @@
+#ifndef FP_FILE_EVENTS_H
+#define FP_FILE_EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// inotify backed record of the last modification of a file
+// A single background thread updates the record of every watched file on IN_MODIFY
+// so checking progress requires no filesystem access
+typedef struct {
+  const char *file_name;
+  int watch;
+  int fd;
+  atomic_bool active;           // Events are being delivered, false once the watch is lost
+  _Atomic uint64_t last_write;  // CLOCK_MONOTONIC nanoseconds of the last modification
+  _Atomic long long bytes;      // File size at the last modification
+} fp_file_events_t;
+
+// Start watching file_name, returns false if events can't be relied upon for this file
+// e.g. it doesn't exist yet or lives on a network filesystem that doesn't report remote writes
+// events must remain valid until fp_file_events_stop
+bool fp_file_events_add(fp_file_events_t *events, const char *file_name);
+
+// Stop the watcher thread and remove every watch
+void fp_file_events_stop(void);
+
+// Called when the recorded last write looks stale, fstat's the held descriptor to confirm
+// Returns false and deactivates the watch if the file changed without an event being delivered
+bool fp_file_events_confirm(fp_file_events_t *events);
+
+uint64_t fp_monotonic_ns(void);
+
+#endif
@@ -11,6 +11,12 @@
 #include <errno.h>
 #include "alps/libalpslli.h"
 #include <fcntl.h>
+#include <glob.h>
+#include "LineCount.h"
+#include "FileEvents.h"
+#include "FileStat.h"
+#include "RateModel.h"
+#include "IntervalCheck.h"
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 #define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR File Progress: %s:%d:%s(): " str, \
@@ -31,55 +37,321 @@ if(fp_debug == 1) {
 
 #define FP_MAX_PATH_LENGTH 2048
 
+// A watched file and the thresholds it is checked against
+typedef struct {
+  char path[FP_MAX_PATH_LENGTH];
+  int fd;
+  dev_t dev;
+  ino_t ino;
+
+  unsigned long min_bytes;
+  unsigned long min_lines;
+  unsigned long min_lines_progress;
+  unsigned long min_bytes_progress;
+  unsigned long stall_timeout;
+  double rate_sigma;          // Deviations below the learned rate that count as a stall, 0 disables
+  unsigned long rate_window;  // Seconds the rate may stay that low
+
+  fp_stat_t stat;         // Size and mtime as of the current check
+  uint64_t last_change;   // CLOCK_MONOTONIC time the size or mtime last changed
+  long long previous_bytes;
+  long long previous_lines;
+  fp_line_counter_t line_counter;
+  fp_rate_model_t byte_rate;
+  fp_rate_model_t line_rate;
+
+  bool events;            // Modifications are reported by inotify
+  fp_file_events_t file_events;
+} fp_watched_file_t;
+
 static bool fp_initialized = false;
 static bool fp_debug = false;
 static unsigned long fp_initial_skips = 1;
 static unsigned long fp_interval_stride = 1;
 static char fp_file[FP_MAX_PATH_LENGTH];
-static unsigned long fp_min_bytes = 0;
-static unsigned long fp_min_lines = 0;
-static unsigned long fp_min_lines_progress = 0;
-static unsigned long fp_min_bytes_progress = 0;
 static unsigned long fp_one_shot = 0;
 static bool fp_single_process = false;
 static bool fp_master_process = false;
 static int lock_fd = -1;
+static bool fp_events = false;
+
+// Learning of the rate models, shared by every file
+static double fp_rate_weight = 0.1;
+static unsigned long fp_rate_warmup = 10;
+
+// Explanation of the last failed check, reported by IntervalCheck
+static char fp_message[FP_MAX_PATH_LENGTH + 256];
+
+#define FAIL_RETURN(str, args...) do { snprintf(fp_message, sizeof(fp_message), str, ##args); \
+                                       return IC_STATUS_FAIL; } while(0)
+
+// Thresholds applied to every file unless overridden in FP_FILES
+static fp_watched_file_t fp_defaults;
+
+// The watch set
+static fp_watched_file_t **fp_files = NULL;
+static int fp_file_count = 0;
+static int fp_file_capacity = 0;
+
+// FP_FILES globs that haven't matched anything yet, retried on every check
+static char **fp_pending = NULL;
+static int fp_pending_count = 0;
+
+// Scratch space for the batched stat of the watch set
+static int *fp_stat_fds = NULL;
+static const char **fp_stat_paths = NULL;
+static fp_stat_t *fp_stat_results = NULL;
+static fp_watched_file_t **fp_stat_files = NULL;
+
+static bool open_file(fp_watched_file_t *file) {
+  file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+  if(file->fd == -1) {
+    return false;
+  }
 
-// Return the number of bytes in file_name
-static long long file_bytes(const char* file_name) {
   struct stat st;
-  int err = stat(file_name, &st);
-  if(err != 0) {
-    SIGKILL_PRINT("Error stating %s: %s\n", file_name, strerror(errno));
+  if(fstat(file->fd, &st) != 0) {
+    close(file->fd);
+    file->fd = -1;
+    return false;
   }
-  return (long long)st.st_size;  
+  file->dev = st.st_dev;
+  file->ino = st.st_ino;
+
+  return true;
 }
 
-// Return the number of lines file_name
-static long long file_lines(const char* file_name) {
-  // Open File and count number of new lines
-  FILE *file = fopen(file_name, "r");
+// Reopen a file whose path now refers to a different file, e.g. after log rotation
+// Progress is measured from the start of the new file
+static void reopen_rotated(fp_watched_file_t *file) {
+  DEBUG_PRINT("%s was rotated, reopening\n", file->path);
+  close(file->fd);
+  fp_line_counter_init(&file->line_counter);
+  file->previous_bytes = 0;
+  file->previous_lines = 0;
+  if(!open_file(file)) {
+    SIGKILL_PRINT("Error opening %s: %s\n", file->path, strerror(errno));
+  }
+}
+
+static void add_file(const char *path, const fp_watched_file_t *thresholds) {
+  if(strlen(path) >= FP_MAX_PATH_LENGTH) {
+    EXIT_PRINT("File path too long: %s\n", path);
+  }
+
+  if(fp_file_count == fp_file_capacity) {
+    fp_file_capacity = fp_file_capacity ? 2*fp_file_capacity : 16;
+    fp_files = realloc(fp_files, fp_file_capacity * sizeof(*fp_files));
+    fp_stat_fds = realloc(fp_stat_fds, fp_file_capacity * sizeof(*fp_stat_fds));
+    fp_stat_paths = realloc(fp_stat_paths, fp_file_capacity * sizeof(*fp_stat_paths));
+    fp_stat_results = realloc(fp_stat_results, fp_file_capacity * sizeof(*fp_stat_results));
+    fp_stat_files = realloc(fp_stat_files, fp_file_capacity * sizeof(*fp_stat_files));
+    if(!fp_files || !fp_stat_fds || !fp_stat_paths || !fp_stat_results || !fp_stat_files) {
+      EXIT_PRINT("Failed to allocate watch set\n");
+    }
+  }
+
+  fp_watched_file_t *file = malloc(sizeof(*file));
   if(file == NULL) {
-    SIGKILL_PRINT("Error opening %s: %s\n", file_name, strerror(errno));
+    EXIT_PRINT("Failed to allocate watch set\n");
+  }
+  *file = *thresholds;
+  strcpy(file->path, path);
+  file->fd = -1;
+  file->last_change = fp_monotonic_ns();
+  file->previous_bytes = 0;
+  file->previous_lines = 0;
+  fp_line_counter_init(&file->line_counter);
+  fp_rate_init(&file->byte_rate);
+  fp_rate_init(&file->line_rate);
+
+  // A file that doesn't exist yet is opened when first checked
+  open_file(file);
+
+  file->events = false;
+  if(fp_events) {
+    file->events = fp_file_events_add(&file->file_events, file->path);
+    if(file->events) {
+      DEBUG_PRINT("Watching %s with inotify\n", file->path);
+    } else {
+      DEBUG_PRINT("inotify unavailable for %s, falling back to polling\n", file->path);
+    }
+  }
+
+  fp_files[fp_file_count++] = file;
+}
+
+// Parse the !option=value list following a FP_FILES entry
+static void parse_thresholds(char *options, fp_watched_file_t *thresholds) {
+  char *option;
+  while((option = strsep(&options, "!"))) {
+    char *value = strchr(option, '=');
+    if(value == NULL) {
+      EXIT_PRINT("Expected option=value in FP_FILES: %s\n", option);
+    }
+    *value++ = '\0';
+
+    unsigned long number = strtoul(value, NULL, 0);
+    if(strcmp(option, "min_bytes") == 0) {
+      thresholds->min_bytes = number;
+    } else if(strcmp(option, "min_lines") == 0) {
+      thresholds->min_lines = number;
+    } else if(strcmp(option, "min_lines_progress") == 0) {
+      thresholds->min_lines_progress = number;
+    } else if(strcmp(option, "min_bytes_progress") == 0) {
+      thresholds->min_bytes_progress = number;
+    } else if(strcmp(option, "stall_timeout") == 0) {
+      thresholds->stall_timeout = number;
+    } else if(strcmp(option, "rate_sigma") == 0) {
+      thresholds->rate_sigma = strtod(value, NULL);
+    } else if(strcmp(option, "rate_window") == 0) {
+      thresholds->rate_window = number;
+    } else {
+      EXIT_PRINT("Unknown FP_FILES option: %s\n", option);
+    }
+  }
+}
+
+// Add the files matching a FP_FILES entry of the form path_or_glob[!option=value...]
+// Returns false if a glob didn't match any files
+static bool expand_spec(const char *spec) {
+  char *buffer = strdup(spec);
+  char *options = strchr(buffer, '!');
+  if(options) {
+    *options++ = '\0';
+  }
+
+  fp_watched_file_t thresholds = fp_defaults;
+  if(options) {
+    parse_thresholds(options, &thresholds);
+  }
+
+  bool matched = true;
+  if(strpbrk(buffer, "*?[") == NULL) {
+    add_file(buffer, &thresholds);
+  } else {
+    glob_t matches;
+    if(glob(buffer, 0, NULL, &matches) == 0) {
+      for(size_t i=0; i<matches.gl_pathc; i++) {
+        add_file(matches.gl_pathv[i], &thresholds);
+      }
+    } else {
+      matched = false;
+    }
+    globfree(&matches);
   }
-  int c;
-  long long new_lines = 0;
-  do {
-    c = fgetc(file);
-    if(c == '\n') {
-      new_lines++;
+
+  free(buffer);
+  return matched;
+}
+
+// Retry globs that haven't yet matched, e.g. restart files that are written later in the run
+static void expand_pending() {
+  int remaining = 0;
+  for(int i=0; i<fp_pending_count; i++) {
+    if(expand_spec(fp_pending[i])) {
+      DEBUG_PRINT("%s now matches files\n", fp_pending[i]);
+      free(fp_pending[i]);
+    } else {
+      fp_pending[remaining++] = fp_pending[i];
+    }
+  }
+  fp_pending_count = remaining;
+}
+
+// Bring the size and mtime of every watched file up to date
+// Files reported by inotify are read from their last event, the rest are stat'd by path in one
+// batch so that a path rotated to a new file is noticed on every check
+static void stat_files(uint64_t now) {
+  int batch = 0;
+
+  for(int i=0; i<fp_file_count; i++) {
+    fp_watched_file_t *file = fp_files[i];
+
+    if(file->events && atomic_load(&file->file_events.active)) {
+      file->stat.size = atomic_load(&file->file_events.bytes);
+      file->stat.error = 0;
+      file->last_change = atomic_load_explicit(&file->file_events.last_write, memory_order_acquire);
+      continue;
+    }
+    file->events = false;
+
+    if(file->fd == -1 && !open_file(file)) {
+      SIGKILL_PRINT("Error stating %s: %s\n", file->path, strerror(errno));
+    }
+
+    fp_stat_fds[batch] = file->fd;
+    fp_stat_paths[batch] = file->path;
+    fp_stat_files[batch] = file;
+    batch++;
+  }
+
+  fp_stat_batch(fp_stat_fds, fp_stat_paths, fp_stat_results, batch);
+
+  for(int i=0; i<batch; i++) {
+    fp_watched_file_t *file = fp_stat_files[i];
+    fp_stat_t *st = &fp_stat_results[i];
+    if(st->error == ENOENT) {
+      // Moved away with nothing in its place yet, a writer holding it open still appends to it
+      fp_stat_batch(&file->fd, NULL, st, 1);
+    } else if(st->error == 0 && (st->dev != file->dev || st->ino != file->ino)) {
+      reopen_rotated(file);
+    }
+    if(st->error != 0) {
+      SIGKILL_PRINT("Error stating %s: %s\n", file->path, strerror(st->error));
+    }
+
+    if(st->size != file->stat.size ||
+       st->mtime.tv_sec != file->stat.mtime.tv_sec ||
+       st->mtime.tv_nsec != file->stat.mtime.tv_nsec) {
+      file->last_change = now;
     }
-  } while(c != EOF);
-  fclose(file);
+    file->stat = *st;
+  }
+}
+
+// Return the number of seconds since the file was last modified
+static double stalled_seconds(fp_watched_file_t *file, uint64_t now) {
+  double stalled = (now - file->last_change) / 1e9;
+  if(stalled <= file->stall_timeout) {
+    return stalled;
+  }
+
+  if(file->events) {
+    if(fp_file_events_confirm(&file->file_events)) {
+      return stalled;
+    }
+
+    // The file changed without us being told, events can't be trusted here
+    DEBUG_PRINT("inotify events not delivered for %s, falling back to polling\n", file->path);
+    file->events = false;
+    file->last_change = now;
+    return 0;
+  }
+
+  return stalled;
+}
 
-  return new_lines;
+// Return the number of lines in the file, only bytes appended since the last check are read
+static long long file_lines(fp_watched_file_t *file) {
+  if(file->fd == -1 && !open_file(file)) {
+    SIGKILL_PRINT("Error opening %s: %s\n", file->path, strerror(errno));
+  }
+
+  long long lines = fp_line_counter_scan(&file->line_counter, file->fd, file->stat.size);
+  if(lines < 0) {
+    SIGKILL_PRINT("Error counting lines in %s: %s\n", file->path, strerror(errno));
+  }
+
+  return lines;
 }
 
-// Kill the batch job
+// Kill the batch job, through IntervalCheck when it provides ic_kill_job
 // This is required as the hangs can make the process non responsive to SIGKILL
-static void kill_job() {
-  // Get App ID
-  int alps_id = atoi(getenv("ALPS_APP_ID"));
+static void kill_job(const char *reason) {
+  if(ic_kill_job) {
+    ic_kill_job(reason);
+  }
 
   DEBUG_PRINT("Sending low level ALPS request to fail\n");
 
@@ -105,10 +377,10 @@ static void check_environment_variables() {
 
   // Number of intervals between checking file progress, after intial number of skipped intervals
   if(getenv("FP_INTERVAL_STRIDE")) {
-    fp_interval_stride = strtoul(getenv("FP_INITIAL_STRIDE"), NULL, 0);
+    fp_interval_stride = strtoul(getenv("FP_INTERVAL_STRIDE"), NULL, 0);
   }
 
-  // File to check
+  // File to check, FP_FILES takes precedence
   if(getenv("FP_FILE")) {
     strcpy(fp_file, getenv("FP_FILE"));
   } else {
@@ -118,22 +390,22 @@ static void check_environment_variables() {
 
   // Minimum filesize in bytes
   if(getenv("FP_MIN_BYTES")) {
-    fp_min_bytes = strtoul(getenv("FP_MIN_BYTES"), NULL, 0);
+    fp_defaults.min_bytes = strtoul(getenv("FP_MIN_BYTES"), NULL, 0);
   }
 
   // Minimum line count
   if(getenv("FP_MIN_LINES")) {
-    fp_min_lines = strtoul(getenv("FP_MIN_LINES"), NULL, 0);
+    fp_defaults.min_lines = strtoul(getenv("FP_MIN_LINES"), NULL, 0);
   }
 
   // Minimum lines added to file since last check
   if(getenv("FP_MIN_LINES_PROGRESS")) {
-    fp_min_lines_progress = strtoul(getenv("FP_MIN_LINES_PROGRESS"), NULL, 0);
+    fp_defaults.min_lines_progress = strtoul(getenv("FP_MIN_LINES_PROGRESS"), NULL, 0);
   }
 
   // Minimum bytes added to file since last check
   if(getenv("FP_MIN_BYTES_PROGRESS")) {
-    fp_min_bytes_progress = strtoul(getenv("FP_MIN_BYTES_PROGRESS"), NULL, 0);
+    fp_defaults.min_bytes_progress = strtoul(getenv("FP_MIN_BYTES_PROGRESS"), NULL, 0);
   }
 
   // Enable a single check after which FileProgress will do nothing
@@ -145,46 +417,162 @@ static void check_environment_variables() {
   if(getenv("FP_SINGLE_PROCESS")) {
     fp_single_process = true;
   } 
+
+  // Maximum number of seconds the file may go without being modified
+  if(getenv("FP_STALL_TIMEOUT")) {
+    fp_defaults.stall_timeout = strtoul(getenv("FP_STALL_TIMEOUT"), NULL, 0);
+  }
+
+  // Fail when a file's byte or line rate stays this many deviations below its learned rate
+  if(getenv("FP_RATE_SIGMA")) {
+    fp_defaults.rate_sigma = strtod(getenv("FP_RATE_SIGMA"), NULL);
+  }
+
+  // Seconds the rate may stay that low before the job is killed
+  fp_defaults.rate_window = 300;
+  if(getenv("FP_RATE_WINDOW")) {
+    fp_defaults.rate_window = strtoul(getenv("FP_RATE_WINDOW"), NULL, 0);
+  }
+
+  // Weight of each check in the learned rate, smaller values remember further back
+  if(getenv("FP_RATE_WEIGHT")) {
+    fp_rate_weight = strtod(getenv("FP_RATE_WEIGHT"), NULL);
+    if(fp_rate_weight <= 0.0 || fp_rate_weight > 1.0) {
+      EXIT_PRINT("FP_RATE_WEIGHT must be greater than 0 and at most 1: %s\n", getenv("FP_RATE_WEIGHT"));
+    }
+  }
+
+  // Checks learned before a file's rate is judged
+  if(getenv("FP_RATE_WARMUP")) {
+    fp_rate_warmup = strtoul(getenv("FP_RATE_WARMUP"), NULL, 0);
+  }
+
+  // Learn about modifications from inotify rather than polling the file
+  if(getenv("FP_MODE")) {
+    if(strcmp(getenv("FP_MODE"), "events") == 0) {
+      fp_events = true;
+    } else if(strcmp(getenv("FP_MODE"), "poll") != 0) {
+      EXIT_PRINT("Unknown FP_MODE: %s\n", getenv("FP_MODE"));
+    }
+  }
+}
+
+// Launcher variables giving the rank of this process in the job, the first one set is used
+static const char *fp_rank_variables[] = {
+  "PMI_RANK", "PMIX_RANK", "SLURM_PROCID", "ALPS_APP_PE", "OMPI_COMM_WORLD_RANK", "MV2_COMM_WORLD_RANK",
+  "PALS_RANKID", "JSM_NAMESPACE_RANK"
+};
+
+// Returns the value of the first of variables that is set, or -1
+static long launcher_id(const char **variables, size_t count, const char **found) {
+  for(size_t i=0; i<count; i++) {
+    const char *value = getenv(variables[i]);
+    char *end;
+    if(value && *value) {
+      long id = strtol(value, &end, 10);
+      if(*end == '\0' && id >= 0) {
+        *found = variables[i];
+        return id;
+      }
+    }
+  }
+  return -1;
+}
+
+// Whether IntervalCheck runs its callbacks in one process per node, IC_SCOPE overrides IC_PER_NODE
+static bool ic_per_node() {
+  const char *scope = getenv("IC_SCOPE");
+  return scope ? strcmp(scope, "per-node") == 0 : getenv("IC_PER_NODE") != NULL;
+}
+
+// Race the other processes for a lock on a file in the working directory, which must be shared
+static bool lock_file_master() {
+  // Create lock file if one doesn't exist
+  // We don't check for a failure to create the file
+  // As a maximum of one process will be able to create it
+  lock_fd = open(".file_progress.lock", O_CREAT|O_RDWR, S_IRUSR | S_IWUSR);
+
+  // Attempt to aquire lock on file
+  struct flock lock_struct;
+  memset(&lock_struct, 0, sizeof(lock_struct));
+
+  lock_struct.l_type = F_WRLCK;
+  lock_struct.l_whence = SEEK_SET;
+  lock_struct.l_pid = getpid();
+
+  // If we aquired the lock we're the master process
+  return fcntl(lock_fd, F_SETLK, &lock_struct) != -1;
+}
+
+// Decide whether this process checks the files for the whole job
+// The identity the launcher gives each process elects one without touching the filesystem. Rank 0
+// checks, or in IntervalCheck's per node mode, where the node's checks run in whichever process
+// leads it, the process on node 0. FP_SINGLE_PROCESS=lock races for the lock file instead.
+static bool elect_master() {
+  const char *variable = NULL;
+  if(strcmp(getenv("FP_SINGLE_PROCESS"), "lock") == 0) {
+    return lock_file_master();
+  }
+
+  if(ic_per_node()) {
+    const char *node_variables[] = { "SLURM_NODEID" };
+    long node = launcher_id(node_variables, sizeof(node_variables)/sizeof(node_variables[0]), &variable);
+    if(node >= 0) {
+      DEBUG_PRINT("Node %ld from %s\n", node, variable);
+      return node == 0;
+    }
+    // Only the node leaders get here, so the race costs one lock per node rather than per rank
+    DEBUG_PRINT("No launcher node id, electing through the lock file\n");
+    return lock_file_master();
+  }
+
+  long rank = launcher_id(fp_rank_variables, sizeof(fp_rank_variables)/sizeof(fp_rank_variables[0]), &variable);
+  if(rank >= 0) {
+    DEBUG_PRINT("Rank %ld from %s\n", rank, variable);
+    return rank == 0;
+  }
+
+  // Not started by a known launcher, most likely the only process
+  fprintf(stderr, "WARNING File Progress: no launcher rank found, checking from this process, set FP_SINGLE_PROCESS=lock to elect through a lock file\n");
+  return true;
 }
 
 static void initialize() {
   check_environment_variables();
 
   if(fp_single_process) {
-    // Create lock file if one doesn't exist, the pwd is expected to be shared amongst the processes
-    lock_fd = open(".file_progress.lock", O_CREAT|O_RDWR, S_IRUSR | S_IWUSR);
-    // We don't check for a failure to create the file
-    // As a maximum of one process will be able to create it
-
-    // Attempt to aquire lock on file
-    struct flock lock_struct;
-    memset(&lock_struct, 0, sizeof(lock_struct));
-
-    lock_struct.l_type = F_WRLCK;
-    lock_struct.l_whence = SEEK_SET;
-    lock_struct.l_pid = getpid();
-
-    int locked = fcntl(lock_fd, F_SETLK, &lock_struct);
-    
-    // If we aquired the lock we're the master process
-    if(locked != -1) {
-      fp_master_process = true;
+    fp_master_process = elect_master();
+    DEBUG_PRINT("%s the checking process\n", fp_master_process ? "Elected" : "Not");
+  }
+
+  // Only the participating processes watch the files
+  if(!fp_single_process || fp_master_process) {
+    if(getenv("FP_FILES")) {
+      char *specs = strdup(getenv("FP_FILES"));
+      char *next = specs;
+      char *spec;
+      while((spec = strsep(&next, ":"))) {
+        if(*spec == '\0') {
+          continue;
+        }
+        if(!expand_spec(spec)) {
+          DEBUG_PRINT("%s doesn't match any files yet\n", spec);
+          fp_pending = realloc(fp_pending, (fp_pending_count + 1) * sizeof(*fp_pending));
+          fp_pending[fp_pending_count++] = strdup(spec);
+        }
+      }
+      free(specs);
     } else {
-      fp_master_process = false;
+      add_file(fp_file, &fp_defaults);
     }
+    DEBUG_PRINT("Watching %d files\n", fp_file_count);
   }
 
   fp_initialized = true;
 }
 
-void file_progress() {
-  if(!fp_initialized) {
-    initialize();
-  }
-
-  // Number of total file interval checks since start
-  static unsigned long long interval_count = 0;
-
+// Check the watch set against its thresholds, interval_count is the number of earlier calls
+static ic_status_t check_files(unsigned long long interval_count, uint64_t now) {
   // If the file check has been performed
   static bool fired = false;
 
@@ -202,53 +590,112 @@ void file_progress() {
 
   // Preform the requested file checks if neccessary
   if(should_check) {
+    if(fp_pending_count > 0) {
+      expand_pending();
+    }
+
+    stat_files(now);
 
-    if(fp_min_bytes > 0) {
-      long long bytes = file_bytes(fp_file);
-      if(bytes < fp_min_bytes) {
-        EXIT_PRINT("%s contains %lld bytes which is less than the required %lu", fp_file, bytes, fp_min_bytes);
-        kill_job();
+    for(int i=0; i<fp_file_count; i++) {
+      fp_watched_file_t *file = fp_files[i];
+      const char *path = file->path;
+
+      // What each check saw is recorded in IntervalCheck's event log rather than printed
+      long long bytes = file->stat.size;
+      ic_event(IC_EVENT_FILE_BYTES, (uint16_t)i, 0, (uint64_t)bytes);
+      long long lines = 0;
+      if(file->min_lines > 0 || file->min_lines_progress > 0 || file->rate_sigma > 0) {
+        lines = file_lines(file);
+        ic_event(IC_EVENT_FILE_LINES, (uint16_t)i, 0, (uint64_t)lines);
       }
-      DEBUG_PRINT("%s contains %lld bytes\n", fp_file, bytes);
-    }
 
-    if(fp_min_lines > 0) {
-      long long lines = file_lines(fp_file);
-      if(lines < fp_min_lines) {
-        EXIT_PRINT("%s contains %lld lines which is less than the required %lu", fp_file, lines, fp_min_lines);
-        kill_job();
+      if(file->stall_timeout > 0) {
+        double stalled = stalled_seconds(file, now);
+        ic_event(IC_EVENT_FILE_IDLE, (uint16_t)i, 0, (uint64_t)(stalled * 1e9));
+        if(stalled > file->stall_timeout) {
+          FAIL_RETURN("%s has not been modified for %.0f seconds, more than the allowed %lu", path, stalled, file->stall_timeout);
+        }
+      }
+
+      if(file->rate_sigma > 0) {
+        fp_rate_params_t params = { file->rate_sigma, fp_rate_weight, fp_rate_warmup };
+        uint64_t window = (uint64_t)file->rate_window * 1000000000ULL;
+        uint64_t low_bytes = fp_rate_update(&file->byte_rate, &params, bytes, now);
+        uint64_t low_lines = fp_rate_update(&file->line_rate, &params, lines, now);
+        if(low_bytes > window) {
+          FAIL_RETURN("%s has grown slower than %.1f bytes/s for %.0f seconds, its learned rate is %.1f bytes/s",
+                      path, fp_rate_threshold(&file->byte_rate, &params), low_bytes/1e9, file->byte_rate.mean);
+        }
+        if(low_lines > window) {
+          FAIL_RETURN("%s has grown slower than %.1f lines/s for %.0f seconds, its learned rate is %.1f lines/s",
+                      path, fp_rate_threshold(&file->line_rate, &params), low_lines/1e9, file->line_rate.mean);
+        }
       }
-      DEBUG_PRINT("%s contains %lld lines\n", fp_file, lines);
-    }
 
-    if(fp_min_lines_progress > 0) {
-      static int previous_lines = 0;
-      long long lines = file_lines(fp_file);
-      long long line_progress = lines - previous_lines;
-      if(line_progress < fp_min_lines_progress) {
-        EXIT_PRINT("%s only added %lld lines but needed to add %lld \n", fp_file, lines - previous_lines, fp_min_lines_progress);
-        kill_job();
+      if(file->min_bytes > 0 && bytes < file->min_bytes) {
+        FAIL_RETURN("%s contains %lld bytes which is less than the required %lu", path, bytes, file->min_bytes);
       }
-      DEBUG_PRINT("%s contained %lld lines and now contains %lld\n", fp_file, lines, previous_lines);
 
-      previous_lines = lines;
-    }
+      if(file->min_lines > 0 && lines < file->min_lines) {
+        FAIL_RETURN("%s contains %lld lines which is less than the required %lu", path, lines, file->min_lines);
+      }
 
-    if(fp_min_bytes_progress > 0) {
-      static int previous_bytes = 0;
-      long long bytes = file_bytes(fp_file);
-      long long bytes_progress = bytes - previous_bytes;
-      if(bytes_progress < fp_min_bytes_progress) {
-        EXIT_PRINT("%s only added %lld bytes but needed to add %lld \n", fp_file, bytes - previous_bytes, fp_min_bytes_progress);
-        kill_job();
+      if(file->min_lines_progress > 0) {
+        long long line_progress = lines - file->previous_lines;
+        if(line_progress < file->min_lines_progress) {
+          FAIL_RETURN("%s only added %lld lines but needed to add %lu", path, line_progress, file->min_lines_progress);
+        }
+        file->previous_lines = lines;
       }
-      DEBUG_PRINT("%s contained %lld bytes and now contains %lld\n", fp_file, bytes, previous_bytes);
 
-      previous_bytes = bytes;
+      if(file->min_bytes_progress > 0) {
+        long long bytes_progress = bytes - file->previous_bytes;
+        if(bytes_progress < file->min_bytes_progress) {
+          FAIL_RETURN("%s only added %lld bytes but needed to add %lu", path, bytes_progress, file->min_bytes_progress);
+        }
+        file->previous_bytes = bytes;
+      }
     }
 
     fired = true;
   }
- 
-  interval_count++;
+
+  return IC_STATUS_OK;
+}
+
+// IntervalCheck plugin interface, setup runs when monitoring starts rather than on the first tick
+static ic_status_t fp_init(void **data) {
+  if(!fp_initialized) {
+    initialize();
+  }
+  return (!fp_single_process || fp_master_process) ? IC_STATUS_OK : IC_STATUS_DISABLE;
+}
+
+static ic_status_t fp_tick(ic_tick_ctx_t *ctx) {
+  ic_status_t status = check_files(ctx->tick, ctx->now);
+  ctx->message = fp_message;
+  return status;
+}
+
+static void fp_finalize(void *data) {
+  fp_file_events_stop();
+}
+
+const ic_plugin_v2_t file_progress_plugin = {
+  IC_PLUGIN_ABI_VERSION, "file_progress", fp_init, fp_tick, fp_finalize
+};
+
+// Callback for versions of IntervalCheck without the plugin interface
+void file_progress() {
+  if(!fp_initialized) {
+    initialize();
+  }
+
+  // Number of total file interval checks since start
+  static unsigned long long interval_count = 0;
+
+  if(check_files(interval_count++, fp_monotonic_ns()) == IC_STATUS_FAIL) {
+    fprintf(stderr, "ERROR File Progress: %s\n", fp_message);
+    kill_job(fp_message);
+  }
 }
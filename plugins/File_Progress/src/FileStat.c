@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "FileStat.h"
+
+// statx is only requested for the fields FileProgress needs so filesystems such as Lustre
+// can skip fetching the rest of the attributes from the servers. The inode tells a rotated path
+// apart from the file held open.
+#ifdef STATX_SIZE
+#define FP_HAVE_STATX
+#define FP_STATX_MASK (STATX_SIZE | STATX_MTIME | STATX_INO)
+#endif
+
+// IORING_OP_STATX arrived in Linux 5.6 along with IORING_FEAT_CUR_PERSONALITY
+#if defined(FP_HAVE_STATX) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_CUR_PERSONALITY
+#define FP_HAVE_IO_URING
+#endif
+#endif
+
+#define FP_RING_ENTRIES 256
+
+static void from_errno(fp_stat_t *result, int error) {
+  memset(result, 0, sizeof(*result));
+  result->error = error;
+}
+
+#ifdef FP_HAVE_STATX
+static void from_statx(fp_stat_t *result, const struct statx *stx) {
+  result->size = (long long)stx->stx_size;
+  result->mtime.tv_sec = stx->stx_mtime.tv_sec;
+  result->mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+  result->dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  result->ino = (ino_t)stx->stx_ino;
+  result->error = 0;
+}
+#endif
+
+static void stat_one(int fd, const char *path, fp_stat_t *result) {
+#ifdef FP_HAVE_STATX
+  struct statx stx;
+  int ret = path ? statx(AT_FDCWD, path, 0, FP_STATX_MASK, &stx) : statx(fd, "", AT_EMPTY_PATH, FP_STATX_MASK, &stx);
+  if(ret == 0) {
+    from_statx(result, &stx);
+    return;
+  }
+  if(errno != ENOSYS) {
+    from_errno(result, errno);
+    return;
+  }
+#endif
+
+  struct stat st;
+  if((path ? stat(path, &st) : fstat(fd, &st)) != 0) {
+    from_errno(result, errno);
+    return;
+  }
+  result->size = (long long)st.st_size;
+  result->mtime = st.st_mtim;
+  result->dev = st.st_dev;
+  result->ino = st.st_ino;
+  result->error = 0;
+}
+
+#ifdef FP_HAVE_IO_URING
+
+static struct {
+  int fd;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned int entries;
+} ring = { .fd = -1 };
+
+// 0 untried, 1 available, -1 unavailable
+static int ring_state = 0;
+
+static bool ring_setup() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = syscall(__NR_io_uring_setup, FP_RING_ENTRIES, &params);
+  if(fd < 0) {
+    return false;
+  }
+  if(!(params.features & IORING_FEAT_CUR_PERSONALITY) || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(fd);
+    return false;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+  char *rings = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if(rings == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  struct io_uring_sqe *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if(sqes == MAP_FAILED) {
+    munmap(rings, ring_size);
+    close(fd);
+    return false;
+  }
+
+  ring.fd = fd;
+  ring.sq_tail = (unsigned int*)(rings + params.sq_off.tail);
+  ring.sq_mask = (unsigned int*)(rings + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned int*)(rings + params.sq_off.array);
+  ring.cq_head = (unsigned int*)(rings + params.cq_off.head);
+  ring.cq_tail = (unsigned int*)(rings + params.cq_off.tail);
+  ring.cq_mask = (unsigned int*)(rings + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+  ring.sqes = sqes;
+  ring.entries = params.sq_entries;
+
+  return true;
+}
+
+// Submit up to ring.entries statx requests and wait for all of them
+static bool ring_stat(const int *fds, const char *const *paths, struct statx *stx, fp_stat_t *results, int count) {
+  unsigned int tail = *ring.sq_tail;
+  for(int i=0; i<count; i++) {
+    unsigned int index = (tail + i) & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    if(paths) {
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long)paths[i];
+    } else {
+      sqe->fd = fds[i];
+      sqe->addr = (unsigned long)"";
+      sqe->statx_flags = AT_EMPTY_PATH;
+    }
+    sqe->len = FP_STATX_MASK;
+    sqe->off = (unsigned long)&stx[i];
+    sqe->user_data = i;
+    ring.sq_array[index] = index;
+  }
+  __atomic_store_n(ring.sq_tail, tail + count, __ATOMIC_RELEASE);
+
+  int submitted = syscall(__NR_io_uring_enter, ring.fd, count, count, IORING_ENTER_GETEVENTS, NULL, 0);
+  if(submitted != count) {
+    return false;
+  }
+
+  int reaped = 0;
+  while(reaped < count) {
+    unsigned int head = *ring.cq_head;
+    unsigned int cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    if(head == cq_tail) {
+      // Completions are normally all posted before io_uring_enter returns
+      if(syscall(__NR_io_uring_enter, ring.fd, 0, count - reaped, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+        return false;
+      }
+      continue;
+    }
+    for(; head != cq_tail; head++, reaped++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      int i = (int)cqe->user_data;
+      if(cqe->res < 0) {
+        from_errno(&results[i], -cqe->res);
+      } else {
+        from_statx(&results[i], &stx[i]);
+      }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return true;
+}
+
+#endif
+
+void fp_stat_batch(const int *fds, const char *const *paths, fp_stat_t *results, int count) {
+#ifdef FP_HAVE_IO_URING
+  if(ring_state == 0) {
+    ring_state = ring_setup() ? 1 : -1;
+  }
+
+  if(ring_state == 1 && count > 1) {
+    static struct statx *stx = NULL;
+    static int stx_count = 0;
+    if(count > stx_count) {
+      free(stx);
+      stx = malloc(count * sizeof(struct statx));
+      stx_count = stx ? count : 0;
+    }
+
+    if(stx) {
+      int done = 0;
+      while(done < count) {
+        int batch = count - done < (int)ring.entries ? count - done : (int)ring.entries;
+        if(!ring_stat(fds + done, paths ? paths + done : NULL, stx + done, results + done, batch)) {
+          // Don't try the ring again, finish this batch with individual calls
+          ring_state = -1;
+          break;
+        }
+        done += batch;
+      }
+      if(done == count) {
+        return;
+      }
+      for(int i=done; i<count; i++) {
+        stat_one(fds[i], paths ? paths[i] : NULL, &results[i]);
+      }
+      return;
+    }
+  }
+#endif
+
+  for(int i=0; i<count; i++) {
+    stat_one(fds[i], paths ? paths[i] : NULL, &results[i]);
+  }
+}
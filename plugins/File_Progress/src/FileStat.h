@@ -0,0 +1,22 @@
+#ifndef FP_FILE_STAT_H
+#define FP_FILE_STAT_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// Size, modification time and identity of a watched file
+typedef struct {
+  long long size;
+  struct timespec mtime;
+  dev_t dev;
+  ino_t ino;
+  int error;          // errno of a failed stat, 0 on success
+} fp_stat_t;
+
+// Stat count files in as few system calls as possible, by path where paths is given, otherwise
+// through the open descriptors
+// statx requests are batched through a single io_uring submission where the kernel supports it,
+// otherwise each file is statx'd, or stat'd, in turn
+void fp_stat_batch(const int *fds, const char *const *paths, fp_stat_t *results, int count);
+
+#endif
@@ -0,0 +1,187 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "LineCount.h"
+
+#ifdef FP_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Size of each pread window
+#define FP_WINDOW_BYTES (4*1024*1024)
+
+static char *window = NULL;
+
+size_t fp_count_newlines_scalar(const char *buf, size_t len) {
+  size_t count = 0;
+  const char *end = buf + len;
+  const char *c = buf;
+
+  // glibc memchr is itself vectorized on most platforms
+  while((c = memchr(c, '\n', end - c)) != NULL) {
+    count++;
+    c++;
+  }
+
+  return count;
+}
+
+#ifdef FP_HAVE_X86_SIMD
+
+// Matches are accumulated as bytes, subtracting the 0xFF compare mask, and flushed with
+// a sum of absolute differences before a byte lane can overflow
+size_t fp_count_newlines_sse2(const char *buf, size_t len) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  size_t count = 0;
+  size_t i = 0;
+
+  while(len - i >= 64) {
+    // Four vectors per iteration, 63 iterations keeps each byte lane at or below 252
+    __m128i acc = _mm_setzero_si128();
+    for(int j=0; j<63 && len - i >= 64; j++, i += 64) {
+      __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i)), newline);
+      __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 16)), newline);
+      __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 32)), newline);
+      __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 48)), newline);
+      acc = _mm_sub_epi8(acc, _mm_add_epi8(_mm_add_epi8(a, b), _mm_add_epi8(c, d)));
+    }
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    count += (size_t)_mm_cvtsi128_si64(sums) + (size_t)_mm_cvtsi128_si64(_mm_srli_si128(sums, 8));
+  }
+
+  return count + fp_count_newlines_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t fp_count_newlines_avx2(const char *buf, size_t len) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i zero = _mm256_setzero_si256();
+  size_t count = 0;
+  size_t i = 0;
+
+  while(len - i >= 64) {
+    // Two vectors per iteration, 127 iterations keeps each byte lane at or below 254
+    __m256i acc = _mm256_setzero_si256();
+    for(int j=0; j<127 && len - i >= 64; j++, i += 64) {
+      __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i)), newline);
+      __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i + 32)), newline);
+      acc = _mm256_sub_epi8(acc, _mm256_add_epi8(a, b));
+    }
+    __m256i sums = _mm256_sad_epu8(acc, zero);
+    count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+             (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+  }
+
+  return count + fp_count_newlines_sse2(buf + i, len - i);
+}
+
+bool fp_cpu_has_avx2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+size_t fp_count_newlines(const char *buf, size_t len) {
+  static size_t (*count_newlines)(const char*, size_t) = NULL;
+
+  if(count_newlines == NULL) {
+#ifdef FP_HAVE_X86_SIMD
+    count_newlines = fp_cpu_has_avx2() ? fp_count_newlines_avx2 : fp_count_newlines_sse2;
+#else
+    count_newlines = fp_count_newlines_scalar;
+#endif
+  }
+
+  return count_newlines(buf, len);
+}
+
+void fp_line_counter_init(fp_line_counter_t *counter) {
+  memset(counter, 0, sizeof(*counter));
+  counter->fd = -1;
+}
+
+void fp_line_counter_close(fp_line_counter_t *counter) {
+  if(counter->fd != -1) {
+    close(counter->fd);
+  }
+  fp_line_counter_init(counter);
+}
+
+static int reopen(fp_line_counter_t *counter, const char *file_name) {
+  fp_line_counter_close(counter);
+
+  counter->fd = open(file_name, O_RDONLY | O_CLOEXEC);
+  if(counter->fd == -1) {
+    return -1;
+  }
+
+  struct stat st;
+  if(fstat(counter->fd, &st) != 0) {
+    fp_line_counter_close(counter);
+    return -1;
+  }
+  counter->dev = st.st_dev;
+  counter->ino = st.st_ino;
+
+  return 0;
+}
+
+long long fp_line_counter_update(fp_line_counter_t *counter, const char *file_name) {
+  // Reopen if the path now refers to a different file, e.g. after log rotation
+  struct stat st;
+  if(stat(file_name, &st) != 0) {
+    return -1;
+  }
+  if(counter->fd == -1 || st.st_dev != counter->dev || st.st_ino != counter->ino) {
+    if(reopen(counter, file_name) != 0) {
+      return -1;
+    }
+  }
+
+  return fp_line_counter_scan(counter, counter->fd, st.st_size);
+}
+
+long long fp_line_counter_scan(fp_line_counter_t *counter, int fd, off_t size) {
+  if(window == NULL) {
+    window = malloc(FP_WINDOW_BYTES);
+    if(window == NULL) {
+      return -1;
+    }
+  }
+
+  // The file was truncated so the previous count is meaningless
+  if(size < counter->offset) {
+    counter->offset = 0;
+    counter->lines = 0;
+  }
+
+  // Scan only the newly appended bytes
+  while(counter->offset < size) {
+    size_t want = FP_WINDOW_BYTES;
+    if((off_t)want > size - counter->offset) {
+      want = size - counter->offset;
+    }
+
+    ssize_t got = pread(fd, window, want, counter->offset);
+    if(got == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if(got == 0) {
+      break;
+    }
+
+    counter->lines += fp_count_newlines(window, got);
+    counter->offset += got;
+  }
+
+  return counter->lines;
+}
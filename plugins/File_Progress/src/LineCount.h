@@ -0,0 +1,41 @@
+#ifndef FP_LINE_COUNT_H
+#define FP_LINE_COUNT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Incremental line counter for a file that is only appended to
+// The file is held open and only bytes appended since the last update are scanned
+typedef struct {
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  off_t offset;     // Number of bytes already scanned
+  long long lines;  // Newlines found in the first offset bytes
+} fp_line_counter_t;
+
+void fp_line_counter_init(fp_line_counter_t *counter);
+void fp_line_counter_close(fp_line_counter_t *counter);
+
+// Bring the line count up to date with file_name, handling truncation and rotation
+// Returns the number of lines or -1 with errno set on failure
+long long fp_line_counter_update(fp_line_counter_t *counter, const char *file_name);
+
+// Bring the line count up to date with the size bytes of an already open fd
+// The caller is responsible for detecting rotation, a smaller size restarts the count
+long long fp_line_counter_scan(fp_line_counter_t *counter, int fd, off_t size);
+
+// Count the '\n' characters in buf using the fastest implementation the CPU supports
+size_t fp_count_newlines(const char *buf, size_t len);
+
+// Individual implementations, exposed for benchmarking
+size_t fp_count_newlines_scalar(const char *buf, size_t len);
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FP_HAVE_X86_SIMD
+size_t fp_count_newlines_sse2(const char *buf, size_t len);
+size_t fp_count_newlines_avx2(const char *buf, size_t len);
+bool fp_cpu_has_avx2(void);
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+#include <string.h>
+#include <math.h>
+#include "RateModel.h"
+
+// The deviation is never taken as less than this fraction of the mean, otherwise a file written at
+// a perfectly steady rate would be low as soon as it slowed down at all
+#define FP_RATE_MIN_DEVIATION 0.1
+
+// A rate below this fraction of the mean is always low, otherwise a file written in bursts learns a
+// deviation so wide the threshold reaches zero and not even a complete stall is low
+#define FP_RATE_MIN_THRESHOLD 0.05
+
+void fp_rate_init(fp_rate_model_t *model) {
+  memset(model, 0, sizeof(*model));
+}
+
+double fp_rate_threshold(const fp_rate_model_t *model, const fp_rate_params_t *params) {
+  double deviation = sqrt(model->variance);
+  if(deviation < FP_RATE_MIN_DEVIATION * model->mean) {
+    deviation = FP_RATE_MIN_DEVIATION * model->mean;
+  }
+  double threshold = model->mean - params->sigma * deviation;
+  if(threshold < FP_RATE_MIN_THRESHOLD * model->mean) {
+    threshold = FP_RATE_MIN_THRESHOLD * model->mean;
+  }
+  return threshold;
+}
+
+uint64_t fp_rate_update(fp_rate_model_t *model, const fp_rate_params_t *params, long long value, uint64_t now) {
+  if(model->sampled == 0 || value < model->previous || now <= model->sampled) {
+    model->previous = value;
+    model->sampled = now;
+    model->low_since = 0;
+    return 0;
+  }
+
+  uint64_t interval_start = model->sampled;
+  model->rate = (double)(value - model->previous) / ((double)(now - model->sampled) / 1e9);
+  model->previous = value;
+  model->sampled = now;
+
+  if(model->samples >= params->warmup && model->rate < fp_rate_threshold(model, params)) {
+    // Progress stopped at some point in this interval, count from its start
+    if(model->low_since == 0) {
+      model->low_since = interval_start;
+    }
+    return now - model->low_since;
+  }
+  model->low_since = 0;
+
+  // Incremental exponentially weighted mean and variance
+  if(model->samples == 0) {
+    model->mean = model->rate;
+    model->variance = 0.0;
+  } else {
+    double difference = model->rate - model->mean;
+    double increment = params->weight * difference;
+    model->mean += increment;
+    model->variance = (1.0 - params->weight) * (model->variance + difference * increment);
+  }
+  model->samples++;
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef FP_RATE_MODEL_H
+#define FP_RATE_MODEL_H
+
+#include <stdint.h>
+
+// Learned progress rate of a growing quantity, such as the bytes or lines of a file
+// The rate between consecutive samples is folded into an exponentially weighted mean and variance.
+// Once warmed up, a rate more than sigma deviations below the mean, or below a small fraction of
+// it, is low. Low rates aren't learned so a stall can't drag the mean down to meet it.
+typedef struct {
+  double mean;            // Weighted mean rate in units per second
+  double variance;        // Weighted variance of the rate
+  double rate;            // Rate over the most recent interval
+  unsigned long samples;  // Number of rates learned
+  long long previous;     // Value at the previous sample
+  uint64_t sampled;       // CLOCK_MONOTONIC time of the previous sample in nanoseconds, 0 before the first
+  uint64_t low_since;     // Start of the interval the rate became low in, 0 while it isn't low
+} fp_rate_model_t;
+
+typedef struct {
+  double sigma;           // Deviations below the mean a rate must fall to be low
+  double weight;          // Weight of each new rate in the mean and variance, between 0 and 1
+  unsigned long warmup;   // Rates learned before any is judged
+} fp_rate_params_t;
+
+void fp_rate_init(fp_rate_model_t *model);
+
+// Add a sample of value taken at now
+// Returns how long the rate has been low in nanoseconds, 0 if it isn't. A value smaller than the
+// previous one, as after truncation or rotation, restarts the interval but keeps what was learned.
+uint64_t fp_rate_update(fp_rate_model_t *model, const fp_rate_params_t *params, long long value, uint64_t now);
+
+// Rate below which progress is low
+double fp_rate_threshold(const fp_rate_model_t *model, const fp_rate_params_t *params);
+
+#endif
@@ -0,0 +1,18 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "alps/libalpslli.h"
+
+// Mock ALPS low level interface
+// A signal request is delivered to the calling process only, standing in for the whole job
+
+int alps_app_lli_put_simple_request(int request, void *data, size_t data_len) {
+  if(request != ALPS_APP_LLI_ALPS_REQ_SIGNAL || data == NULL || data_len < 2*sizeof(int32_t)) {
+    return -1;
+  }
+
+  int32_t signal_number = ((int32_t*)data)[0];
+  fprintf(stderr, "MOCK ALPS: signal %d requested for the job\n", signal_number);
+  fflush(stderr);
+  return raise(signal_number) == 0 ? 0 : -1;
+}
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nvml.h"
+
+// Mock NVML for building, testing and benchmarking the plugin without a GPU
+// Every call counts towards a global call number, faults are injected by environment variables
+//   MOCK_NVML_GPU_COUNT  : Number of GPUs reported(default 8)
+//   MOCK_NVML_LATENCY    : Time each call takes in microseconds(default 0)
+//   MOCK_NVML_HANG_AFTER : Calls after this many never return(default unset)
+//   MOCK_NVML_FAIL_AFTER : Calls after this many return MOCK_NVML_ERROR(default unset)
+//   MOCK_NVML_FAIL_COUNT : Number of calls that fail before calls succeed again(default unlimited)
+//   MOCK_NVML_ERROR      : nvmlReturn_t value returned by failing calls(default 15, NVML_ERROR_GPU_IS_LOST)
+//   MOCK_NVML_CALLS      : Print the number of calls to each function at exit if set(default unset)
+
+enum { CALL_INIT, CALL_SHUTDOWN, CALL_GET_COUNT, CALL_GET_HANDLE, CALL_GET_PCI_INFO, CALL_TYPES };
+
+static const char *call_names[CALL_TYPES] = {
+  "nvmlInit", "nvmlShutdown", "nvmlDeviceGetCount", "nvmlDeviceGetHandleByIndex", "nvmlDeviceGetPciInfo"
+};
+
+#define MAX_GPUS 64
+
+static struct nvmlDevice_st {
+  unsigned int index;
+} devices[MAX_GPUS];
+
+static pthread_once_t configured = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int gpu_count = 8;
+static unsigned long latency_us = 0;
+static unsigned long hang_after = 0;
+static unsigned long fail_after = 0;
+static unsigned long fail_count = 0;
+static nvmlReturn_t fail_error = NVML_ERROR_GPU_IS_LOST;
+
+static unsigned long call_number = 0;
+static unsigned long failures = 0;
+static unsigned long calls[CALL_TYPES];
+static int init_count = 0;
+
+static unsigned long env_ulong(const char *name, unsigned long default_value) {
+  return getenv(name) ? strtoul(getenv(name), NULL, 10) : default_value;
+}
+
+static void print_call_counts() {
+  for(int i=0; i<CALL_TYPES; i++) {
+    fprintf(stderr, "MOCK NVML: %s called %lu times\n", call_names[i], calls[i]);
+  }
+}
+
+static void configure() {
+  gpu_count = env_ulong("MOCK_NVML_GPU_COUNT", gpu_count);
+  if(gpu_count > MAX_GPUS) {
+    gpu_count = MAX_GPUS;
+  }
+  for(unsigned int i=0; i<MAX_GPUS; i++) {
+    devices[i].index = i;
+  }
+
+  latency_us = env_ulong("MOCK_NVML_LATENCY", 0);
+  hang_after = env_ulong("MOCK_NVML_HANG_AFTER", 0);
+  fail_after = env_ulong("MOCK_NVML_FAIL_AFTER", 0);
+  fail_count = env_ulong("MOCK_NVML_FAIL_COUNT", 0);
+  fail_error = (nvmlReturn_t)env_ulong("MOCK_NVML_ERROR", NVML_ERROR_GPU_IS_LOST);
+
+  if(getenv("MOCK_NVML_CALLS")) {
+    atexit(print_call_counts);
+  }
+}
+
+// Count the call and apply any injected latency, hang or error
+static nvmlReturn_t enter(int type) {
+  pthread_once(&configured, configure);
+
+  pthread_mutex_lock(&lock);
+  unsigned long number = ++call_number;
+  calls[type]++;
+  bool fail = fail_after > 0 && number > fail_after && (fail_count == 0 || failures < fail_count);
+  if(fail) {
+    failures++;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if(latency_us > 0) {
+    struct timespec latency = { latency_us / 1000000, (latency_us % 1000000) * 1000 };
+    nanosleep(&latency, NULL);
+  }
+
+  if(hang_after > 0 && number > hang_after) {
+    while(true) {
+      pause();
+    }
+  }
+
+  return fail ? fail_error : NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlInit(void) {
+  nvmlReturn_t result = enter(CALL_INIT);
+  if(result == NVML_SUCCESS) {
+    __atomic_add_fetch(&init_count, 1, __ATOMIC_SEQ_CST);
+  }
+  return result;
+}
+
+nvmlReturn_t nvmlShutdown(void) {
+  nvmlReturn_t result = enter(CALL_SHUTDOWN);
+  if(result != NVML_SUCCESS) {
+    return result;
+  }
+  if(__atomic_load_n(&init_count, __ATOMIC_SEQ_CST) == 0) {
+    return NVML_ERROR_UNINITIALIZED;
+  }
+  __atomic_sub_fetch(&init_count, 1, __ATOMIC_SEQ_CST);
+  return NVML_SUCCESS;
+}
+
+const char *nvmlErrorString(nvmlReturn_t result) {
+  switch(result) {
+    case NVML_SUCCESS: return "Success";
+    case NVML_ERROR_UNINITIALIZED: return "Uninitialized";
+    case NVML_ERROR_INVALID_ARGUMENT: return "Invalid Argument";
+    case NVML_ERROR_NOT_FOUND: return "Not Found";
+    case NVML_ERROR_TIMEOUT: return "Timeout";
+    case NVML_ERROR_GPU_IS_LOST: return "GPU is lost";
+    default: return "Unknown Error";
+  }
+}
+
+nvmlReturn_t nvmlDeviceGetCount(unsigned int *deviceCount) {
+  nvmlReturn_t result = enter(CALL_GET_COUNT);
+  if(result != NVML_SUCCESS) {
+    return result;
+  }
+  if(__atomic_load_n(&init_count, __ATOMIC_SEQ_CST) == 0) {
+    return NVML_ERROR_UNINITIALIZED;
+  }
+  *deviceCount = gpu_count;
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByIndex(unsigned int index, nvmlDevice_t *device) {
+  nvmlReturn_t result = enter(CALL_GET_HANDLE);
+  if(result != NVML_SUCCESS) {
+    return result;
+  }
+  if(__atomic_load_n(&init_count, __ATOMIC_SEQ_CST) == 0) {
+    return NVML_ERROR_UNINITIALIZED;
+  }
+  if(index >= gpu_count || device == NULL) {
+    return NVML_ERROR_INVALID_ARGUMENT;
+  }
+  *device = &devices[index];
+  return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPciInfo(nvmlDevice_t device, nvmlPciInfo_t *pci) {
+  nvmlReturn_t result = enter(CALL_GET_PCI_INFO);
+  if(result != NVML_SUCCESS) {
+    return result;
+  }
+  if(__atomic_load_n(&init_count, __ATOMIC_SEQ_CST) == 0) {
+    return NVML_ERROR_UNINITIALIZED;
+  }
+  if(device < &devices[0] || device >= &devices[gpu_count] || pci == NULL) {
+    return NVML_ERROR_INVALID_ARGUMENT;
+  }
+
+  // Bus ids laid out like a node with one GPU per bus
+  unsigned int bus = 0x02 + device->index * 0x10;
+  *pci = (nvmlPciInfo_t){ .domain = 0, .bus = bus, .device = 0, .pciDeviceId = 0x102d10de };
+  snprintf(pci->busId, sizeof(pci->busId), "0000:%02x:00.0", bus);
+  return NVML_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#ifndef MOCK_ALPS_LIBALPSLLI_H
+#define MOCK_ALPS_LIBALPSLLI_H
+
+// The subset of the ALPS low level interface used by the plugins, implemented by MockAlps.c
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALPS_APP_LLI_ALPS_REQ_SIGNAL 1
+
+int alps_app_lli_put_simple_request(int request, void *data, size_t data_len);
+
+#endif
@@ -8,9 +8,10 @@
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include "nvml.h"
-#include <cuda_runtime.h>
 #include "alps/libalpslli.h"
+#include "IntervalCheck.h"
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 #define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR Check GPU: %s:%d:%s(): " str, \
@@ -31,7 +32,8 @@ if(gh_debug == 1) {
 
 #define ALPSKILL_PRINT(str, args...) do { fprintf(stderr, "ERROR Check GPU: %s:%d:%s(): " str, \
 		                               __FILE__, __LINE__, __func__, ##args); \
-	                                    kill_job(); } while(0)
+	                                    snprintf(gh_message, sizeof(gh_message), str, ##args); \
+	                                    kill_job(gh_message); } while(0)
 
 static bool initialized = false;
 static unsigned int gh_gpu_count = 0;
@@ -40,12 +42,26 @@ static bool passed_last_test = true;
 static unsigned int watchdog_timeout = 0;
 static struct itimerspec watchdog_time;
 static timer_t watchdog_id = 0;
+static struct timespec watchdog_armed;
 
-// Kill the batch job
+// NVML session kept open between checks, with the handle and PCI bus id of every GPU
+static bool nvml_open = false;
+static nvmlDevice_t *gh_devices = NULL;
+static char (*gh_bus_ids)[NVML_DEVICE_PCI_BUS_ID_BUFFER_SIZE] = NULL;
+static unsigned int gh_cached_count = 0;
+
+// Explanation of the last failed check, reported by IntervalCheck
+static char gh_message[256];
+
+#define FAIL_RETURN(str, args...) do { snprintf(gh_message, sizeof(gh_message), str, ##args); \
+                                       return IC_STATUS_FAIL; } while(0)
+
+// Kill the batch job, through IntervalCheck when it provides ic_kill_job
 // This is required as the hangs can make the process non responsive to SIGKILL
-static void kill_job() {
-  // Get App ID
-  int alps_id = atoi(getenv("ALPS_APP_ID"));
+static void kill_job(const char *reason) {
+  if(ic_kill_job) {
+    ic_kill_job(reason);
+  }
 
   DEBUG_PRINT("Sending low level ALPS request to fail\n");
 
@@ -62,37 +78,72 @@ static void watchdog_handler(int sig) {
   ALPSKILL_PRINT("Watchdog timer for GPU Health expired: GPU hung for %d seconds\n", watchdog_timeout);
 }
 
-// Determine the number of GPU's available on the system
-static void set_gpu_count() {
+// Open an NVML session and cache every device handle and PCI bus id
+// The GPU count is only queried if it wasn't set by GH_GPU_COUNT, sets failed_gpu to a device that failed
+// Also reopens a stale session from a check, so it records nothing itself
+static nvmlReturn_t open_session(unsigned int *failed_gpu) {
+  nvmlReturn_t nvml_err = nvmlInit();
+  if(nvml_err != NVML_SUCCESS) {
+    return nvml_err;
+  }
+  nvml_open = true;
 
-  // If the value is specified don't worry about initilization
-  if(getenv("GH_GPU_COUNT")) {
-    gh_gpu_count = atoi(getenv("GH_GPU_COUNT"));
-    return;
-  } 
-  else {
-    nvmlReturn_t nvml_err;
+  if(gh_gpu_count == 0) {
+    nvml_err = nvmlDeviceGetCount(&gh_gpu_count);
+    if(nvml_err != NVML_SUCCESS) {
+      return nvml_err;
+    }
+  }
 
-    // Init NVML
-    nvml_err = nvmlInit();
+  if(gh_cached_count != gh_gpu_count) {
+    free(gh_devices);
+    free(gh_bus_ids);
+    gh_devices = calloc(gh_gpu_count, sizeof(*gh_devices));
+    gh_bus_ids = calloc(gh_gpu_count, sizeof(*gh_bus_ids));
+    if(gh_devices == NULL || gh_bus_ids == NULL) {
+      EXIT_PRINT("Failed to allocate GPU handles\n");
+    }
+    gh_cached_count = gh_gpu_count;
+  }
+
+  for(unsigned int i=0; i<gh_gpu_count; i++) {
+    nvml_err = nvmlDeviceGetHandleByIndex(i, &gh_devices[i]);
     if(nvml_err != NVML_SUCCESS) {
-      ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
+      *failed_gpu = i;
+      return nvml_err;
     }
 
-    // Get number of GPUs
-    nvmlDeviceGetCount(&gh_gpu_count);
+    nvmlPciInfo_t pci;
+    nvml_err = nvmlDeviceGetPciInfo(gh_devices[i], &pci);
     if(nvml_err != NVML_SUCCESS) {
-      ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
-    } else {
-      DEBUG_PRINT("%d GPUs detected\b", gh_gpu_count);
+      *failed_gpu = i;
+      return nvml_err;
     }
+    snprintf(gh_bus_ids[i], sizeof(gh_bus_ids[i]), "%s", pci.busId);
+  }
+
+  return NVML_SUCCESS;
+}
 
-    // Cleanup NVML
-    nvml_err = nvmlShutdown();
+static void close_session() {
+  if(nvml_open) {
+    nvmlShutdown();
+    nvml_open = false;
+  }
+}
+
+// Query each cached device once, this should fail if a GPU is off the bus
+// Sets failed_gpu to the device that failed
+static nvmlReturn_t query_gpus(unsigned int *failed_gpu) {
+  for(unsigned int i=0; i<gh_gpu_count; i++) {
+    nvmlPciInfo_t pci;
+    nvmlReturn_t nvml_err = nvmlDeviceGetPciInfo(gh_devices[i], &pci);
     if(nvml_err != NVML_SUCCESS) {
-      ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
+      *failed_gpu = i;
+      return nvml_err;
     }
   }
+  return NVML_SUCCESS;
 }
 
 // Check for any useful environment variables
@@ -145,8 +196,10 @@ static void init_watchdog() {
 }
 
 // Arm the watchdog timer
+// Arm and disarm run on every check, they are recorded in IntervalCheck's event log rather than printed
 static void arm_watchdog() {
-  DEBUG_PRINT("Arming Watchdog timer\n");
+  clock_gettime(CLOCK_MONOTONIC, &watchdog_armed);
+  ic_event(IC_EVENT_WATCHDOG_ARM, 0, 0, (uint64_t)watchdog_timeout * 1000000000ULL);
 
   // Set the singleshot watchdog timer
   watchdog_time.it_interval.tv_sec = 0;
@@ -163,7 +216,10 @@ static void arm_watchdog() {
 
 // Disarm the watchdog timer
 static void disarm_watchdog() {
-  DEBUG_PRINT("Disarming Watchdog timer\n");
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ic_event(IC_EVENT_WATCHDOG_DISARM, 0, 0, (uint64_t)(now.tv_sec - watchdog_armed.tv_sec) * 1000000000ULL
+                                           + now.tv_nsec - watchdog_armed.tv_nsec);
 
   // Set the singleshot watchdog timer
   watchdog_time.it_interval.tv_sec = 0;
@@ -179,98 +235,138 @@ static void disarm_watchdog() {
 }
 
 // Initialize the health checker, this should only be called once
-static void initialize() {
+// Returns the NVML error if the session couldn't be opened, the caller decides how to fail
+static nvmlReturn_t initialize() {
   check_environment_variables();
 
   // Prep the watchdog timer
   init_watchdog();
 
-  // Determine GPU count if not explicitly set
-  if(gh_gpu_count == 0) {
-    // This can potentially fail so we watchdog it
-    arm_watchdog();
-    set_gpu_count();
-    disarm_watchdog();
+  // Open the NVML session used by every check, this can potentially hang so we watchdog it
+  unsigned int failed_gpu;
+  arm_watchdog();
+  nvmlReturn_t nvml_err = open_session(&failed_gpu);
+  disarm_watchdog();
+  if(nvml_err != NVML_SUCCESS) {
+    return nvml_err;
+  }
+
+  // Discovery runs once outside of the timer path, so it can still be printed
+  DEBUG_PRINT("%u GPUs detected\n", gh_gpu_count);
+  for(unsigned int i=0; i<gh_gpu_count; i++) {
+    DEBUG_PRINT("GPU %u (domain:bus:device) -> %s\n", i, gh_bus_ids[i]);
   }
 
   initialized = true;
+  return NVML_SUCCESS;
 }
 
-// Attempt to initialize NVML and run basic query, If this succeeds the GPU should be in OK shape
-void gpu_health(int sig) {
-
-  // Preform initialization step
-  if(!initialized) {
-    passed_last_test = false;
-    initialize();
-    passed_last_test = true;
-  }
+// Release the watchdog and the NVML session
+static void teardown() {
+  timer_delete(watchdog_id);
+  signal(SIGUSR1, SIG_DFL);
+
+  close_session();
+  free(gh_devices);
+  free(gh_bus_ids);
+  gh_devices = NULL;
+  gh_bus_ids = NULL;
+  gh_cached_count = 0;
+  initialized = false;
+}
 
+// Run a basic query on every GPU through the open NVML session, If this succeeds the GPUs should be in OK shape
+static ic_status_t check_gpus() {
   // Start singleshot watchdog timer
   arm_watchdog();
   
   // If the GPU is locked up very tight the nvml_* funcitons hang
   // so we test if our last test ever finished
   if(!passed_last_test) {
-    fprintf(stderr, "GPU Health Failure: GPU likely hung\n");
-    kill_job();
+    disarm_watchdog();
+    FAIL_RETURN("GPU Health Failure: GPU likely hung");
   }
 
   passed_last_test = false;
-  nvmlReturn_t nvml_err;
 
-  // Init NVML
-  DEBUG_PRINT("Calling nvmlInit\n");
-  nvml_err = nvmlInit();
+  // Out of range until a query names the device that failed
+  unsigned int failed_gpu = UINT_MAX;
+  nvmlReturn_t nvml_err = nvml_open ? query_gpus(&failed_gpu) : NVML_ERROR_UNINITIALIZED;
+
+  // The session may have gone stale, reopen it once before declaring the GPUs unhealthy
   if(nvml_err != NVML_SUCCESS) {
-    fprintf(stderr, "NVML Failure: %s\n", nvmlErrorString(nvml_err));
-    kill_job();
+    uint16_t device = failed_gpu < gh_gpu_count ? (uint16_t)failed_gpu : UINT16_MAX;
+    uint32_t query_err = (uint32_t)nvml_err;
+    close_session();
+    nvml_err = open_session(&failed_gpu);
+    ic_event(IC_EVENT_NVML_REOPEN, device, query_err, (uint64_t)nvml_err);
+    if(nvml_err == NVML_SUCCESS) {
+      nvml_err = query_gpus(&failed_gpu);
+    }
   }
 
-  // Attempt to aquire a handle to all devices
-  // This should fail in the GPU is in a "bad" state
-  for(int i=0; i<gh_gpu_count; i++) {
-    DEBUG_PRINT("Attemping to get handle to GPU %d of %d\n", i, gh_gpu_count);
-    nvmlDevice_t device_handle;
-    nvml_err = nvmlDeviceGetHandleByIndex(i, &device_handle);
-    if(nvml_err != NVML_SUCCESS) {
-      ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
-    }
+  // The tests have finished, passed or not
+  passed_last_test = true;
 
-    // Check PCI info for each device
-    nvmlPciInfo_t pci;
-    nvmlDevice_t device;
-    for(int g_id=0; g_id<gh_gpu_count; g_id++) {
-      // Get device handle
-      nvml_err = nvmlDeviceGetHandleByIndex(g_id, &device);
-      if(nvml_err != NVML_SUCCESS) {
-        ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
-      }
-
-      // Get PCI info, this should fail if GPU is off the bus
-      nvml_err = nvmlDeviceGetPciInfo(device, &pci);
-      if(nvml_err != NVML_SUCCESS) {
-        ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
-      } else {
-        DEBUG_PRINT("(domain:bus:device) -> %s\n", pci.busId);
-      }
-    }
+  // Disarm the watchdog timer
+  disarm_watchdog();
 
+  if(nvml_err != NVML_SUCCESS) {
+    if(failed_gpu < gh_cached_count) {
+      FAIL_RETURN("NVML Failure on GPU %u (%s): %s", failed_gpu, gh_bus_ids[failed_gpu], nvmlErrorString(nvml_err));
+    }
+    FAIL_RETURN("NVML Failure: %s", nvmlErrorString(nvml_err));
   }
 
-  // The tests have passed(or died trying to pass)
-  passed_last_test = true;
+  return IC_STATUS_OK;
+}
 
-  // Cleanup NVML
-  DEBUG_PRINT("Calling nvmlShutdown\n");
-  nvml_err = nvmlShutdown();
-  if(nvml_err != NVML_SUCCESS) {
-    fprintf(stderr, "NVML Failure: %s\n", nvmlErrorString(nvml_err));
-    kill_job();
+// IntervalCheck plugin interface, GPU discovery runs when monitoring starts rather than on the first tick
+static ic_status_t gh_init(void **data) {
+  if(!initialized) {
+    passed_last_test = false;
+    nvmlReturn_t nvml_err = initialize();
+    passed_last_test = true;
+    if(nvml_err != NVML_SUCCESS) {
+      // init has no message, report it here and let IntervalCheck act on the status
+      snprintf(gh_message, sizeof(gh_message), "NVML Failure: %s", nvmlErrorString(nvml_err));
+      fprintf(stderr, "ERROR Check GPU: %s\n", gh_message);
+      teardown();
+      return IC_STATUS_FAIL;
+    }
   }
+  return IC_STATUS_OK;
+}
 
-  // Disarm the watchdog timer
-  disarm_watchdog();
+static ic_status_t gh_tick(ic_tick_ctx_t *ctx) {
+  ic_status_t status = check_gpus();
+  ctx->message = gh_message;
+  return status;
+}
+
+static void gh_finalize(void *data) {
+  teardown();
+}
+
+const ic_plugin_v2_t gpu_health_plugin = {
+  IC_PLUGIN_ABI_VERSION, "gpu_health", gh_init, gh_tick, gh_finalize
+};
+
+// Callback for versions of IntervalCheck without the plugin interface
+void gpu_health(int sig) {
 
-  DEBUG_PRINT("GPU check passed\n");
+  // Preform initialization step
+  if(!initialized) {
+    passed_last_test = false;
+    nvmlReturn_t nvml_err = initialize();
+    passed_last_test = true;
+    if(nvml_err != NVML_SUCCESS) {
+      ALPSKILL_PRINT("NVML Failure: %s\n", nvmlErrorString(nvml_err));
+    }
+  }
+
+  if(check_gpus() == IC_STATUS_FAIL) {
+    fprintf(stderr, "%s\n", gh_message);
+    kill_job(gh_message);
+  }
 }
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "IntervalCheck.h"
+
+// Synthetic workloads for trying out the Process Health thresholds
+//   healthy: computes and beats a heartbeat
+//   spin:    computes without heartbeats or I/O, as a rank spinning on a flag that never changes
+//   block:   sleeps without heartbeats or I/O, as a rank blocked in a collective that never completes
+//   io:      computes and appends to a file, without heartbeats
+//   leak:    computes, beats a heartbeat and allocates another megabyte every step
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec)/1e9;
+}
+
+// Roughly a millisecond of arithmetic
+static double compute(double x) {
+  for(int i=0; i<200000; i++) {
+    x = x * 1.0000001 + 1e-9;
+  }
+  return x;
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2) {
+    fprintf(stderr, "Usage: %s healthy|spin|block|io|leak [seconds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *mode = argv[1];
+  double duration = argc > 2 ? strtod(argv[2], NULL) : 60.0;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  volatile double x = 1.0;
+  FILE *out = NULL;
+  if(strcmp(mode, "io") == 0) {
+    out = tmpfile();
+  }
+
+  unsigned long steps = 0;
+  while(seconds_since(&start) < duration) {
+    if(strcmp(mode, "block") == 0) {
+      usleep(100000);
+      continue;
+    }
+    x = compute(x);
+    steps++;
+    if(strcmp(mode, "healthy") == 0) {
+      ic_heartbeat(0);
+    } else if(out && steps % 10 == 0) {
+      fprintf(out, "step %lu %f\n", steps, x);
+      fflush(out);
+    } else if(strcmp(mode, "leak") == 0 && steps % 10 == 0) {
+      char *block = malloc(1 << 20);
+      memset(block, 1, 1 << 20);
+      ic_heartbeat(0);
+    }
+  }
+
+  printf("%s: %lu steps\n", mode, steps);
+  return EXIT_SUCCESS;
+}
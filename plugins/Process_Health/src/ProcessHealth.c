@@ -0,0 +1,329 @@
+#include <sys/types.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "IntervalCheck.h"
+
+#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR Process Health: %s:%d:%s(): " str, \
+                                               __FILE__, __LINE__, __func__, ##args); \
+                                      exit(EXIT_FAILURE); } while(0)
+
+#define DEBUG_PRINT(str, args...) do {                                              \
+if(ph_debug == 1) {                                                                 \
+  printf("PH DEBUG: %s: %d: %s: " str, __FILENAME__, __LINE__, __func__, ##args); } \
+} while(0)
+
+// Process health sampled from /proc
+// The files are opened once when monitoring starts and read with pread on every tick, so a tick
+// costs four small reads with no path lookup or allocation. The process is stalled while its I/O
+// and heartbeat counters are unchanged, it is then
+//   idle: using less than PH_IDLE_CPU of a core, e.g. blocked in a syscall or deadlocked
+//   spinning: using more than PH_SPIN_CPU of a core, e.g. in a spin-wait that will never end
+// and fails once it has been either for the timeout. RSS that keeps rising for PH_RSS_WINDOW is a
+// runaway.
+
+enum { PH_STAT, PH_STATM, PH_IO, PH_SCHEDSTAT, PH_FILES };
+static const char *ph_paths[PH_FILES] = { "/proc/self/stat", "/proc/self/statm", "/proc/self/io", "/proc/self/schedstat" };
+static int ph_fds[PH_FILES] = { -1, -1, -1, -1 };
+
+typedef struct {
+  uint64_t time;       // CLOCK_MONOTONIC nanoseconds
+  uint64_t cpu_ticks;  // User and system time of every thread
+  uint64_t rss_pages;
+  uint64_t io_bytes;   // Bytes read and written by any means, less the reads of these files
+  uint64_t switches;   // Times the main thread was scheduled
+  uint64_t heartbeats; // Sum of every heartbeat counter
+  char state;          // State of the main thread
+} ph_sample_t;
+
+#define PH_RSS_CHECKPOINTS 16
+
+static bool ph_debug = false;
+static bool ph_warn_only = false;
+static double ph_idle_cpu = 0.01;
+static unsigned long ph_idle_timeout = 600;
+static double ph_spin_cpu = 0.9;
+static unsigned long ph_spin_timeout = 0;
+static double ph_io_quiet = 1024;
+static unsigned long ph_rss_limit = 0;
+static unsigned long ph_rss_growth = 0;
+static unsigned long ph_rss_window = 600;
+
+static long ph_clock_ticks;
+static long ph_page_size;
+
+static bool ph_sampled = false;
+static ph_sample_t ph_previous;
+static ph_sample_t ph_stall_start; // First sample of the current stall
+static bool ph_stalled = false;
+static bool ph_idle = false;       // Whether the stall so far is idle or spinning
+static uint64_t ph_own_bytes = 0;  // Bytes these files returned, counted by /proc/self/io
+
+// RSS every PH_RSS_WINDOW / PH_RSS_CHECKPOINTS, oldest first
+static ph_sample_t ph_rss_checkpoints[PH_RSS_CHECKPOINTS];
+static int ph_rss_count = 0;
+
+// Explanation of the last failed check, reported by IntervalCheck
+static char ph_message[256];
+
+#define FAIL_RETURN(str, args...) do { snprintf(ph_message, sizeof(ph_message), str, ##args); \
+                                       return ph_warn_only ? IC_STATUS_WARN : IC_STATUS_FAIL; } while(0)
+
+// Read the file into buffer, returns its length or -1 if it couldn't be read
+static ssize_t read_file(int file, char *buffer, size_t size) {
+  if(ph_fds[file] == -1) {
+    return -1;
+  }
+  ssize_t length = pread(ph_fds[file], buffer, size - 1, 0);
+  if(length < 0) {
+    return -1;
+  }
+  ph_own_bytes += (uint64_t)length;
+  buffer[length] = '\0';
+  return length;
+}
+
+// Parse the unsigned number following the field'th space separated field of str, counting from 0
+static uint64_t field(const char *str, int index) {
+  for(int i=0; i<index && str; i++) {
+    str = strchr(str, ' ');
+    if(str) {
+      str++;
+    }
+  }
+  return str ? strtoull(str, NULL, 10) : 0;
+}
+
+// Parse the value of name in a "name: value" line
+static uint64_t named_value(const char *str, const char *name) {
+  const char *line = strstr(str, name);
+  return line ? strtoull(line + strlen(name), NULL, 10) : 0;
+}
+
+static void sample(ph_sample_t *s, uint64_t now) {
+  char buffer[1024];
+  memset(s, 0, sizeof(*s));
+  s->time = now;
+
+  // The command name may contain spaces, fields are counted from the state after its last ')'
+  if(read_file(PH_STAT, buffer, sizeof(buffer)) > 0) {
+    const char *fields = strrchr(buffer, ')');
+    if(fields && fields[1] == ' ') {
+      fields += 2;
+      s->state = fields[0];
+      s->cpu_ticks = field(fields, 11) + field(fields, 12);
+    }
+  }
+
+  if(read_file(PH_STATM, buffer, sizeof(buffer)) > 0) {
+    s->rss_pages = field(buffer, 1);
+  }
+
+  if(read_file(PH_SCHEDSTAT, buffer, sizeof(buffer)) > 0) {
+    s->switches = field(buffer, 2);
+  }
+
+  // Read last so that every earlier read of these files is already counted
+  uint64_t own = ph_own_bytes;
+  if(read_file(PH_IO, buffer, sizeof(buffer)) > 0) {
+    uint64_t total = named_value(buffer, "rchar:") + named_value(buffer, "wchar:");
+    s->io_bytes = total > own ? total - own : 0;
+  }
+
+  if(ic_heartbeat_totals) {
+    uint64_t totals[IC_MAX_COUNTERS];
+    ic_heartbeat_totals(totals);
+    for(int i=0; i<IC_MAX_COUNTERS; i++) {
+      s->heartbeats += totals[i];
+    }
+  }
+}
+
+// Fail if RSS rose between every pair of checkpoints over the window and by at least ph_rss_growth MB
+static ic_status_t check_rss(const ph_sample_t *s, uint64_t period) {
+  uint64_t rss_mb = s->rss_pages * ph_page_size >> 20;
+  if(ph_rss_limit > 0 && rss_mb > ph_rss_limit) {
+    FAIL_RETURN("RSS of %lu MB exceeds the limit of %lu MB", (unsigned long)rss_mb, ph_rss_limit);
+  }
+  if(ph_rss_growth == 0) {
+    return IC_STATUS_OK;
+  }
+
+  // Ticks jitter, take a checkpoint from the tick nearest to the spacing rather than the one after
+  uint64_t spacing = (uint64_t)ph_rss_window * 1000000000ULL / PH_RSS_CHECKPOINTS;
+  if(ph_rss_count > 0 && s->time - ph_rss_checkpoints[ph_rss_count-1].time + period/2 < spacing) {
+    return IC_STATUS_OK;
+  }
+  if(ph_rss_count == PH_RSS_CHECKPOINTS) {
+    memmove(&ph_rss_checkpoints[0], &ph_rss_checkpoints[1], (PH_RSS_CHECKPOINTS - 1) * sizeof(ph_sample_t));
+    ph_rss_count--;
+  }
+  ph_rss_checkpoints[ph_rss_count++] = *s;
+  if(ph_rss_count < PH_RSS_CHECKPOINTS) {
+    return IC_STATUS_OK;
+  }
+
+  for(int i=1; i<PH_RSS_CHECKPOINTS; i++) {
+    if(ph_rss_checkpoints[i].rss_pages <= ph_rss_checkpoints[i-1].rss_pages) {
+      return IC_STATUS_OK;
+    }
+  }
+  uint64_t growth_mb = (s->rss_pages - ph_rss_checkpoints[0].rss_pages) * ph_page_size >> 20;
+  if(growth_mb >= ph_rss_growth) {
+    FAIL_RETURN("RSS grew by %lu MB to %lu MB over the last %.0f seconds without levelling off", (unsigned long)growth_mb,
+                (unsigned long)rss_mb, (double)(s->time - ph_rss_checkpoints[0].time)/1e9);
+  }
+  return IC_STATUS_OK;
+}
+
+static ic_status_t check_process(uint64_t now, uint64_t period) {
+  ph_sample_t current;
+  sample(&current, now);
+
+  ic_status_t status = check_rss(&current, period);
+  if(status != IC_STATUS_OK) {
+    return status;
+  }
+
+  if(!ph_sampled || current.time <= ph_previous.time) {
+    ph_sampled = true;
+    ph_previous = current;
+    return IC_STATUS_OK;
+  }
+
+  double seconds = (double)(current.time - ph_previous.time) / 1e9;
+  double cores = (double)(current.cpu_ticks - ph_previous.cpu_ticks) / ph_clock_ticks / seconds;
+  double io_rate = (double)(current.io_bytes - ph_previous.io_bytes) / seconds;
+  bool quiet = io_rate < ph_io_quiet && current.heartbeats == ph_previous.heartbeats;
+  bool idle = cores < ph_idle_cpu;
+  bool spinning = cores >= ph_spin_cpu;
+
+  // A stall lasts while the process stays quiet and either idle or spinning throughout
+  if(quiet && (idle || spinning) && (!ph_stalled || ph_idle == idle)) {
+    if(!ph_stalled) {
+      ph_stalled = true;
+      ph_idle = idle;
+      ph_stall_start = ph_previous;
+    }
+  } else {
+    ph_stalled = false;
+  }
+  ph_previous = current;
+
+  if(ph_stalled) {
+    double stalled = (double)(current.time - ph_stall_start.time) / 1e9;
+    double average = (double)(current.cpu_ticks - ph_stall_start.cpu_ticks) / ph_clock_ticks / stalled;
+    unsigned long switches = (unsigned long)(current.switches - ph_stall_start.switches);
+    if(ph_idle && ph_idle_timeout > 0 && stalled > ph_idle_timeout) {
+      FAIL_RETURN("No CPU progress for %.0f seconds, %.1f%% of a core with no I/O or heartbeats, main thread state %c scheduled %lu times",
+                  stalled, 100.0*average, current.state, switches);
+    }
+    if(!ph_idle && ph_spin_timeout > 0 && stalled > ph_spin_timeout) {
+      FAIL_RETURN("Spinning for %.0f seconds, %.1f%% of a core with no I/O or heartbeats, main thread state %c scheduled %lu times",
+                  stalled, 100.0*average, current.state, switches);
+    }
+  }
+
+  return IC_STATUS_OK;
+}
+
+static double env_double(const char *name, double default_value) {
+  return getenv(name) ? strtod(getenv(name), NULL) : default_value;
+}
+
+static unsigned long env_ulong(const char *name, unsigned long default_value) {
+  return getenv(name) ? strtoul(getenv(name), NULL, 0) : default_value;
+}
+
+// Check for any useful environment variables
+static void check_environment_variables() {
+  if(getenv("PH_DEBUG")) {
+    ph_debug = true;
+  }
+
+  // Report problems as warnings rather than killing the job
+  if(getenv("PH_WARN_ONLY")) {
+    ph_warn_only = true;
+  }
+
+  // Fraction of a core below which a stalled process is idle and the seconds it may stay so
+  ph_idle_cpu = env_double("PH_IDLE_CPU", ph_idle_cpu);
+  ph_idle_timeout = env_ulong("PH_IDLE_TIMEOUT", ph_idle_timeout);
+
+  // Fraction of a core above which a stalled process is spinning and the seconds it may stay so
+  ph_spin_cpu = env_double("PH_SPIN_CPU", ph_spin_cpu);
+  ph_spin_timeout = env_ulong("PH_SPIN_TIMEOUT", ph_spin_timeout);
+  if(ph_spin_cpu <= ph_idle_cpu) {
+    EXIT_PRINT("PH_SPIN_CPU must be greater than PH_IDLE_CPU\n");
+  }
+
+  // Bytes per second of I/O below which the process counts as doing none
+  ph_io_quiet = env_double("PH_IO_QUIET", ph_io_quiet);
+
+  // RSS limit and the growth over PH_RSS_WINDOW seconds that counts as runaway, in MB
+  ph_rss_limit = env_ulong("PH_RSS_LIMIT", ph_rss_limit);
+  ph_rss_growth = env_ulong("PH_RSS_GROWTH", ph_rss_growth);
+  ph_rss_window = env_ulong("PH_RSS_WINDOW", ph_rss_window);
+  if(ph_rss_growth > 0 && ph_rss_window == 0) {
+    EXIT_PRINT("PH_RSS_WINDOW must be greater than 0\n");
+  }
+}
+
+// IntervalCheck plugin interface, the files are opened when monitoring starts
+static ic_status_t ph_init(void **data) {
+  check_environment_variables();
+
+  // /proc/self would be the !isolate helper or icd, which sit idle while the application runs
+  if(ic_monitoring_self && !ic_monitoring_self()) {
+    snprintf(ph_message, sizeof(ph_message), "not running in the monitored application, e.g. under icd or with !isolate");
+    fprintf(stderr, "WARNING Process Health: %s, disabled\n", ph_message);
+    return IC_STATUS_DISABLE;
+  }
+
+  ph_clock_ticks = sysconf(_SC_CLK_TCK);
+  ph_page_size = sysconf(_SC_PAGESIZE);
+
+  for(int i=0; i<PH_FILES; i++) {
+    ph_fds[i] = open(ph_paths[i], O_RDONLY | O_CLOEXEC);
+    if(ph_fds[i] == -1) {
+      DEBUG_PRINT("Failed to open %s: %s\n", ph_paths[i], strerror(errno));
+    }
+  }
+  if(ph_fds[PH_STAT] == -1) {
+    snprintf(ph_message, sizeof(ph_message), "%s can't be read", ph_paths[PH_STAT]);
+    return IC_STATUS_DISABLE;
+  }
+  if(ph_fds[PH_IO] == -1) {
+    fprintf(stderr, "WARNING Process Health: %s can't be read, I/O is not taken into account\n", ph_paths[PH_IO]);
+  }
+
+  DEBUG_PRINT("Monitoring process %d, idle below %.0f%% for %lus, spinning above %.0f%% for %lus\n", (int)getpid(),
+              100.0*ph_idle_cpu, ph_idle_timeout, 100.0*ph_spin_cpu, ph_spin_timeout);
+  return IC_STATUS_OK;
+}
+
+static ic_status_t ph_tick(ic_tick_ctx_t *ctx) {
+  ic_status_t status = check_process(ctx->now, ctx->period);
+  ctx->message = ph_message;
+  return status;
+}
+
+static void ph_finalize(void *data) {
+  for(int i=0; i<PH_FILES; i++) {
+    if(ph_fds[i] != -1) {
+      close(ph_fds[i]);
+      ph_fds[i] = -1;
+    }
+  }
+}
+
+const ic_plugin_v2_t process_health_plugin = {
+  IC_PLUGIN_ABI_VERSION, "process_health", ph_init, ph_tick, ph_finalize
+};
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "IntervalCheckInternal.h"
+
+// Placement of the monitoring work
+// The monitor, workers, helpers and other internal threads call ic_affinity_apply when they start
+// so their wakeups land on IC_CPUSET rather than preempting the application. The default, auto,
+// takes the highest numbered SMT sibling the process may run on whose core has another sibling in
+// the mask, which is idle when the application runs a thread per core.
+//
+// Time on IC_CPUSET is only free if the application can't run there. The mask is compared with the
+// one the application's threads inherit, and when the two overlap, as auto's always do, every tick
+// is counted as taken from the application and the threads only drop to nice 19 rather than
+// SCHED_IDLE, for the reason given in monitor_main.
+
+static pthread_once_t affinity_once = PTHREAD_ONCE_INIT;
+static cpu_set_t monitor_cpus;
+static bool pinned = false;
+static bool exclusive = false; // Pinned to cpus the application can't run on
+static atomic_bool pin_failed = false;
+
+// Parse a cpu list such as 3,7-8 as used by taskset -c and sysfs
+static bool parse_cpulist(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  const char *c = list;
+  while(*c != '\0' && *c != '\n') {
+    char *end;
+    unsigned long first = strtoul(c, &end, 10);
+    unsigned long last = first;
+    if(end == c) {
+      return false;
+    }
+    if(*end == '-') {
+      c = end + 1;
+      last = strtoul(c, &end, 10);
+      if(end == c || last < first) {
+        return false;
+      }
+    }
+    if(last >= CPU_SETSIZE) {
+      return false;
+    }
+    for(unsigned long cpu=first; cpu<=last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    c = end;
+    if(*c == ',') {
+      c++;
+    }
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+static bool read_siblings(int cpu, cpu_set_t *siblings) {
+  char path[96];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) {
+    return false;
+  }
+  char list[256];
+  ssize_t length = read(fd, list, sizeof(list) - 1);
+  close(fd);
+  if(length <= 0) {
+    return false;
+  }
+  list[length] = '\0';
+  return parse_cpulist(list, siblings);
+}
+
+// Highest numbered cpu of the mask that isn't the first thread of its core, -1 if none
+static int spare_sibling(const cpu_set_t *allowed) {
+  for(int cpu=CPU_SETSIZE-1; cpu>=0; cpu--) {
+    if(!CPU_ISSET(cpu, allowed)) {
+      continue;
+    }
+    cpu_set_t siblings;
+    if(!read_siblings(cpu, &siblings)) {
+      continue;
+    }
+    CPU_AND(&siblings, &siblings, allowed);
+    if(CPU_COUNT(&siblings) < 2) {
+      continue;
+    }
+    for(int first=0; first<cpu; first++) {
+      if(CPU_ISSET(first, &siblings)) {
+        return cpu;
+      }
+    }
+  }
+  return -1;
+}
+
+// Runs on the first thread to start, before it is pinned, so the mask read is the one the
+// application's threads inherit
+static void affinity_init(void) {
+  const char *cpuset = getenv("IC_CPUSET") ? getenv("IC_CPUSET") : "auto";
+
+  if(strcmp(cpuset, "none") == 0) {
+    return;
+  }
+
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    CPU_ZERO(&allowed);
+  }
+
+  if(strcmp(cpuset, "auto") == 0) {
+    int cpu = spare_sibling(&allowed);
+    if(cpu == -1) {
+      DEBUG_PRINT("No spare SMT sibling in the affinity mask, monitoring is not pinned\n");
+      return;
+    }
+    CPU_ZERO(&monitor_cpus);
+    CPU_SET(cpu, &monitor_cpus);
+    DEBUG_PRINT("Monitoring pinned to SMT sibling %d, which the application may also run on\n", cpu);
+  } else {
+    if(!parse_cpulist(cpuset, &monitor_cpus)) {
+      EXIT_PRINT("Invalid IC_CPUSET, expected auto, none or a cpu list such as 3,7-8: %s\n", cpuset);
+    }
+    DEBUG_PRINT("Monitoring pinned to cpus %s\n", cpuset);
+  }
+  pinned = true;
+
+  cpu_set_t shared;
+  CPU_AND(&shared, &allowed, &monitor_cpus);
+  exclusive = CPU_COUNT(&shared) == 0;
+  if(!exclusive && strcmp(cpuset, "auto") != 0) {
+    ERROR_PRINT("IC_CPUSET %s overlaps the cpus the application may run on, monitoring still competes with it\n", cpuset);
+  }
+}
+
+// Move the calling thread, or helper process, onto the monitoring cpus at low priority
+void ic_affinity_apply(void) {
+  pthread_once(&affinity_once, affinity_init);
+
+  if(pinned) {
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(monitor_cpus), &monitor_cpus);
+    if(err == 0) {
+      struct sched_param param = { 0 };
+      if(exclusive && pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0) {
+        return;
+      }
+    } else if(!atomic_exchange(&pin_failed, true)) {
+      ERROR_PRINT("Failed to pin monitoring to IC_CPUSET, leaving it to the kernel: %s\n", strerror(err));
+    }
+  }
+  setpriority(PRIO_PROCESS, 0, 19);
+}
+
+// Whether the calling thread is on a cpu the application may be using
+static bool on_application_cpu(void) {
+  int cpu = sched_getcpu();
+  return !exclusive || cpu < 0 || !CPU_ISSET(cpu, &monitor_cpus);
+}
+
+// Start measuring the calling thread's CPU time taken from the application
+// Ticks run from the SIGALRM handler, by a thread that isn't pinned or on cpus the application
+// shares count in full. Safe in a signal handler.
+void ic_noise_begin(ic_noise_probe_t *probe) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  probe->cpu_time = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+  probe->application = on_application_cpu();
+}
+
+// CPU time since ic_noise_begin if the thread was on an application cpu at either end, otherwise 0
+uint64_t ic_noise_end(const ic_noise_probe_t *probe) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  uint64_t used = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec - probe->cpu_time;
+  return probe->application || on_application_cpu() ? used : 0;
+}
+
+// Summarise the time each callback took from the application with IC_DEBUG set
+void ic_noise_report(void) {
+  for(int i=0; i<ic_entry_count; i++) {
+    const ic_entry_t *entry = &ic_entries[i];
+    if(entry->ticks > 0) {
+      DEBUG_PRINT("%s took %.1fus of application cpu time per tick over %llu ticks\n", entry->name,
+                  (double)entry->stolen / entry->ticks / 1000.0, (unsigned long long)entry->ticks);
+    }
+  }
+}
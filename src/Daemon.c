@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stddef.h>
+#include "IntervalCheckInternal.h"
+
+// Out of process monitoring, IC_MODE=daemon
+// Instead of running callbacks an application process connects to the node's icd over a Unix
+// socket and hands it a memfd holding its heartbeat counters, so the only in process cost is this
+// registration. The connection stays open for the life of the process: icd sees it close when the
+// process exits and a clean exit is announced from IC_finalize first. icd runs the callbacks and
+// plugins on its own timer and checks each registered process through /proc.
+
+#define IC_DAEMON_PROTOCOL 1
+#define IC_DAEMON_MAX_CLIENTS 1024
+
+enum { IC_DAEMON_REGISTER = 1, IC_DAEMON_EXIT };
+
+typedef struct {
+  uint32_t protocol;
+  uint32_t type;
+} ic_daemon_msg_t;
+
+bool ic_daemon = false;
+
+// Abstract socket named after the user and job, or the path in IC_DAEMON_SOCKET
+static socklen_t daemon_address(struct sockaddr_un *address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+
+  if(getenv("IC_DAEMON_SOCKET")) {
+    snprintf(address->sun_path, sizeof(address->sun_path), "%s", getenv("IC_DAEMON_SOCKET"));
+    return sizeof(*address);
+  }
+
+  ic_job_object_name(address->sun_path + 1, sizeof(address->sun_path) - 1, "icd");
+  return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(address->sun_path + 1);
+}
+
+// Client side, linked into the preloaded library
+
+static int daemon_fd = -1;
+
+static bool send_message(int fd, uint32_t type, int pass_fd) {
+  ic_daemon_msg_t msg = { IC_DAEMON_PROTOCOL, type };
+  struct iovec iov = { &msg, sizeof(msg) };
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+
+  char control[CMSG_SPACE(sizeof(int))];
+  if(pass_fd != -1) {
+    memset(control, 0, sizeof(control));
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+  }
+
+  // The daemon may have gone, that must not raise SIGPIPE in the application
+  return sendmsg(fd, &header, MSG_NOSIGNAL) == sizeof(msg);
+}
+
+// Register this process with icd, returns false if no daemon is listening for this job
+bool ic_daemon_register(void) {
+  struct sockaddr_un address;
+  socklen_t length = daemon_address(&address);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if(fd == -1) {
+    return false;
+  }
+  if(connect(fd, (struct sockaddr*)&address, length) != 0) {
+    DEBUG_PRINT("Failed to connect to icd: %s\n", strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  // Heartbeat counters live in a memfd shared with the daemon, without one they go unchecked
+  int counters_fd = memfd_create("ic_counters", MFD_CLOEXEC);
+  ic_counters_t *counters = MAP_FAILED;
+  if(counters_fd != -1 && ftruncate(counters_fd, sizeof(ic_counters_t)) == 0) {
+    counters = mmap(NULL, sizeof(ic_counters_t), PROT_READ | PROT_WRITE, MAP_SHARED, counters_fd, 0);
+  }
+
+  bool sent = send_message(fd, IC_DAEMON_REGISTER, counters != MAP_FAILED ? counters_fd : -1);
+  if(counters_fd != -1) {
+    close(counters_fd);
+  }
+  if(!sent) {
+    if(counters != MAP_FAILED) {
+      munmap(counters, sizeof(ic_counters_t));
+    }
+    close(fd);
+    return false;
+  }
+
+  if(counters != MAP_FAILED) {
+    ic_counters_attach(counters);
+  }
+  daemon_fd = fd;
+  DEBUG_PRINT("Registered with icd\n");
+  return true;
+}
+
+// Tell icd this process is exiting cleanly
+void ic_daemon_unregister(void) {
+  if(daemon_fd == -1) {
+    return;
+  }
+  send_message(daemon_fd, IC_DAEMON_EXIT, -1);
+  close(daemon_fd);
+  daemon_fd = -1;
+}
+
+// Daemon side, run by icd
+
+typedef struct {
+  int fd;
+  pid_t pid;
+  bool finalized;
+  bool stopped;
+  ic_counters_t *counters;
+  ic_counter_watch_t watch;
+} ic_client_t;
+
+// Clients are added and removed by the serving thread and checked by the monitor thread
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static ic_client_t clients[IC_DAEMON_MAX_CLIENTS];
+static int client_count = 0;
+static bool registered_any = false;
+static int listen_fd = -1;
+
+void ic_daemon_listen(void) {
+  struct sockaddr_un address;
+  socklen_t length = daemon_address(&address);
+
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if(listen_fd == -1) {
+    EXIT_PRINT("Failed to create socket: %s\n", strerror(errno));
+  }
+  if(address.sun_path[0] != '\0') {
+    unlink(address.sun_path);
+  }
+  if(bind(listen_fd, (struct sockaddr*)&address, length) != 0) {
+    EXIT_PRINT("Failed to bind %s, is icd already running for this job: %s\n",
+               address.sun_path[0] ? address.sun_path : address.sun_path + 1, strerror(errno));
+  }
+  if(listen(listen_fd, SOMAXCONN) != 0) {
+    EXIT_PRINT("Failed to listen: %s\n", strerror(errno));
+  }
+}
+
+static void accept_clients() {
+  int fd;
+  while((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+    // Only processes of the daemon's own user are watched, and may be killed
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 || credentials.uid != getuid()) {
+      close(fd);
+      continue;
+    }
+
+    pthread_mutex_lock(&clients_lock);
+    if(client_count == IC_DAEMON_MAX_CLIENTS) {
+      pthread_mutex_unlock(&clients_lock);
+      ERROR_PRINT("Too many processes, %d will not be monitored\n", credentials.pid);
+      close(fd);
+      continue;
+    }
+    ic_client_t *client = &clients[client_count++];
+    memset(client, 0, sizeof(*client));
+    client->fd = fd;
+    client->pid = credentials.pid;
+    pthread_mutex_unlock(&clients_lock);
+  }
+}
+
+static void remove_client(int index) {
+  ic_client_t *client = &clients[index];
+  if(!client->finalized) {
+    ERROR_PRINT("Process %d exited without finalizing\n", client->pid);
+  }
+  DEBUG_PRINT("Process %d disconnected\n", client->pid);
+
+  close(client->fd);
+  if(client->counters) {
+    munmap(client->counters, sizeof(ic_counters_t));
+  }
+  clients[index] = clients[--client_count];
+}
+
+// Read the messages of a client, returns false once it has disconnected
+static bool read_client(ic_client_t *client) {
+  while(true) {
+    ic_daemon_msg_t msg;
+    struct iovec iov = { &msg, sizeof(msg) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    ssize_t length = recvmsg(client->fd, &header, MSG_CMSG_CLOEXEC);
+    if(length == -1 && (errno == EAGAIN || errno == EINTR)) {
+      return true;
+    }
+    if(length <= 0) {
+      return false;
+    }
+
+    int counters_fd = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&counters_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if(length != sizeof(msg) || msg.protocol != IC_DAEMON_PROTOCOL) {
+      ERROR_PRINT("Process %d uses an unsupported protocol\n", client->pid);
+    } else if(msg.type == IC_DAEMON_REGISTER && client->counters == NULL) {
+      if(counters_fd != -1) {
+        void *counters = mmap(NULL, sizeof(ic_counters_t), PROT_READ, MAP_SHARED, counters_fd, 0);
+        client->counters = counters != MAP_FAILED ? counters : NULL;
+      }
+      registered_any = true;
+      DEBUG_PRINT("Registered process %d\n", client->pid);
+    } else if(msg.type == IC_DAEMON_EXIT) {
+      client->finalized = true;
+    }
+
+    if(counters_fd != -1) {
+      close(counters_fd);
+    }
+  }
+}
+
+// Serve registrations until stop_fd is readable or every registered process has gone
+void ic_daemon_serve(int stop_fd) {
+  static struct pollfd fds[IC_DAEMON_MAX_CLIENTS + 2];
+
+  while(!registered_any || client_count > 0) {
+    fds[0].fd = stop_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd;
+    fds[1].events = POLLIN;
+    int count = client_count;
+    for(int i=0; i<count; i++) {
+      fds[i + 2].fd = clients[i].fd;
+      fds[i + 2].events = POLLIN;
+    }
+
+    if(poll(fds, count + 2, -1) == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      EXIT_PRINT("poll failed: %s\n", strerror(errno));
+    }
+    if(fds[0].revents) {
+      DEBUG_PRINT("Stopping\n");
+      break;
+    }
+
+    // Only this thread removes clients so indices are stable until the lock is taken
+    for(int i=count-1; i>=0; i--) {
+      if(fds[i + 2].revents && !read_client(&clients[i])) {
+        pthread_mutex_lock(&clients_lock);
+        remove_client(i);
+        pthread_mutex_unlock(&clients_lock);
+      }
+    }
+    if(fds[1].revents) {
+      accept_clients();
+    }
+  }
+
+  DEBUG_PRINT("No processes left to monitor\n");
+}
+
+// Returns the state letter of pid from /proc, or 0 if it no longer exists
+static char process_state(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) {
+    return 0;
+  }
+  char stat[512];
+  ssize_t length = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if(length <= 0) {
+    return 0;
+  }
+  stat[length] = '\0';
+
+  char *fields = strrchr(stat, ')');
+  return fields && fields[1] == ' ' ? fields[2] : 0;
+}
+
+// Built in callback run by icd, checks every registered process in one pass
+// Stopped processes are reported and processes whose heartbeats stall are killed
+void ic_daemon_check(void) {
+  int alive = 0;
+  pid_t stalled_pid = 0;
+  char reason[128];
+
+  pthread_mutex_lock(&clients_lock);
+  for(int i=0; i<client_count; i++) {
+    ic_client_t *client = &clients[i];
+    if(client->finalized) {
+      continue;
+    }
+
+    // An exit is reported when the connection closes
+    char state = process_state(client->pid);
+    if(state == 0 || state == 'Z' || state == 'X') {
+      continue;
+    }
+
+    bool stopped = state == 'T' || state == 't';
+    if(stopped && !client->stopped) {
+      ERROR_PRINT("Process %d is stopped\n", client->pid);
+    }
+    client->stopped = stopped;
+
+    if(client->counters) {
+      uint64_t now = ic_now();
+      int stalled = ic_counters_stalled(client->counters, &client->watch, now);
+      if(stalled != -1) {
+        snprintf(reason, sizeof(reason), "Process %d heartbeat counter %d has not advanced for %.0f seconds",
+                 client->pid, stalled, (double)(now - client->watch.changed[stalled])/NSEC_PER_SEC);
+        stalled_pid = client->pid;
+        break;
+      }
+    }
+    alive++;
+  }
+  pthread_mutex_unlock(&clients_lock);
+
+  // Outside the lock, the self backend kills every client through ic_daemon_kill_clients
+  if(stalled_pid > 0) {
+    ic_kill_job_over(stalled_pid, reason);
+  }
+
+  ic_event(IC_EVENT_ALIVE, 0, 0, (uint64_t)alive);
+}
+
+// Kill every registered process, used by icd when a check fails
+void ic_daemon_kill_clients(void) {
+  pthread_mutex_lock(&clients_lock);
+  for(int i=0; i<client_count; i++) {
+    if(!clients[i].finalized) {
+      kill(clients[i].pid, SIGKILL);
+    }
+  }
+  pthread_mutex_unlock(&clients_lock);
+}
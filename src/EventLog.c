@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include "IntervalCheckInternal.h"
+
+// Binary event log, enabled by IC_EVENT_LOG
+// Events are fixed size records claimed from a ring buffer with a compare and swap on its head
+// and published by a per slot sequence number, so any thread or signal handler can record one
+// without locks. A background thread appends the published records to the log file. The file is
+// opened with O_APPEND and every block is a single write, so the processes on a node can share one
+// file, e.g. IC_EVENT_LOG=/tmp/ic_events.%h. Only the process running the callbacks records.
+
+// Power of two, at 40 bytes a slot the ring takes 160KB
+#define EVENT_RING_SIZE 4096
+#define EVENT_DRAIN_BATCH 256
+#define EVENT_DRAIN_INTERVAL_MS 250
+
+typedef struct {
+  _Atomic uint64_t sequence; // Claimed position plus one once the record is complete
+  ic_event_record_t record;
+} ic_event_slot_t;
+
+static ic_event_slot_t *ring = NULL;
+static _Atomic uint64_t ring_head = 0;
+static _Atomic uint64_t ring_tail = 0;
+static _Atomic uint64_t dropped = 0;
+static atomic_bool enabled = false;
+
+static int log_fd = -1;
+static uint32_t log_pid = 0;
+static pthread_t drain_thread;
+static int drain_wake_fd = -1;
+
+// Held while records are copied out and written, by the drain thread or a flush
+static atomic_flag draining = ATOMIC_FLAG_INIT;
+
+// Callback being run by this thread, attributed to every event it records
+static IC_TLS uint16_t current_entry = IC_EVENT_NO_ENTRY;
+
+void ic_event_log_set_entry(const ic_entry_t *entry) {
+  current_entry = entry ? (uint16_t)(entry - ic_entries) : IC_EVENT_NO_ENTRY;
+}
+
+IC_EXPORT void (ic_event)(uint16_t type, uint16_t id, uint32_t status, uint64_t value) {
+  if(!atomic_load_explicit(&enabled, memory_order_relaxed)) {
+    return;
+  }
+
+  // A slot is free once the drain has moved the tail past its previous use
+  uint64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  do {
+    if(head - atomic_load_explicit(&ring_tail, memory_order_acquire) >= EVENT_RING_SIZE) {
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return;
+    }
+  } while(!atomic_compare_exchange_weak_explicit(&ring_head, &head, head + 1, memory_order_relaxed,
+                                                 memory_order_relaxed));
+
+  ic_event_slot_t *slot = &ring[head & (EVENT_RING_SIZE - 1)];
+  slot->record = (ic_event_record_t){ ic_now(), value, log_pid, status, type, id, current_entry, 0 };
+  atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+}
+
+static void write_records(const ic_event_record_t *records, size_t count) {
+  size_t size = count * sizeof(ic_event_record_t);
+  ssize_t written = write(log_fd, records, size);
+  if(written != (ssize_t)size) {
+    ERROR_PRINT("Failed to write event log, disabling it: %s\n", written == -1 ? strerror(errno) : "short write");
+    atomic_store(&enabled, false);
+  }
+}
+
+// Write every published record, stopping at the first slot that is claimed but still being filled
+static void drain() {
+  ic_event_record_t buffer[EVENT_DRAIN_BATCH + 1];
+  uint64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+
+  while(log_fd != -1) {
+    size_t count = 0;
+    uint64_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if(lost > 0) {
+      buffer[count++] = (ic_event_record_t){ ic_now(), lost, log_pid, 0, IC_EVENT_DROPPED, 0, IC_EVENT_NO_ENTRY, 0 };
+    }
+
+    while(count < EVENT_DRAIN_BATCH) {
+      ic_event_slot_t *slot = &ring[tail & (EVENT_RING_SIZE - 1)];
+      if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + 1) {
+        break;
+      }
+      buffer[count++] = slot->record;
+      tail++;
+    }
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+
+    if(count == 0) {
+      break;
+    }
+    write_records(buffer, count);
+    if(count < EVENT_DRAIN_BATCH) {
+      break;
+    }
+  }
+}
+
+// Drain from the calling thread, e.g. before ic_kill_job ends the process
+void ic_event_log_flush(void) {
+  if(log_fd == -1) {
+    return;
+  }
+  while(atomic_flag_test_and_set(&draining)) {
+    sched_yield();
+  }
+  drain();
+  atomic_flag_clear(&draining);
+}
+
+static void *drain_main(void *arg) {
+  ic_affinity_apply();
+
+  struct pollfd wake = { drain_wake_fd, POLLIN, 0 };
+  while(true) {
+    int ready = poll(&wake, 1, EVENT_DRAIN_INTERVAL_MS);
+    if(ready == -1 && errno != EINTR) {
+      break;
+    }
+    ic_event_log_flush();
+    if(ready > 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Write the process record and the callback names that the decoder resolves entry indices with
+static void write_preamble() {
+  size_t count = 1;
+  for(int i=0; i<ic_entry_count; i++) {
+    count += 1 + (strlen(ic_entries[i].name) + sizeof(ic_event_record_t) - 1) / sizeof(ic_event_record_t);
+  }
+  ic_event_record_t *records = calloc(count, sizeof(ic_event_record_t));
+  if(records == NULL) {
+    EXIT_PRINT("Failed to allocate event log preamble\n");
+  }
+
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  records[0] = (ic_event_record_t){ ic_now(), (uint64_t)real.tv_sec*NSEC_PER_SEC + real.tv_nsec, log_pid,
+                                    IC_EVENT_LOG_VERSION, IC_EVENT_PROCESS, (uint16_t)ic_entry_count,
+                                    IC_EVENT_NO_ENTRY, 0 };
+
+  size_t index = 1;
+  for(int i=0; i<ic_entry_count; i++) {
+    size_t length = strlen(ic_entries[i].name);
+    records[index] = (ic_event_record_t){ records[0].time, length, log_pid, 0, IC_EVENT_NAME, (uint16_t)i,
+                                          IC_EVENT_NO_ENTRY, 0 };
+    memcpy(&records[index + 1], ic_entries[i].name, length);
+    index += 1 + (length + sizeof(ic_event_record_t) - 1) / sizeof(ic_event_record_t);
+  }
+
+  write_records(records, count);
+  free(records);
+}
+
+// Open the log and start the drain thread, path may contain %h for the host name and %p for the pid
+void ic_event_log_start(const char *path) {
+  char *expanded = ic_expand_path(path);
+  log_fd = open(expanded, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if(log_fd == -1) {
+    EXIT_PRINT("Failed to open event log %s: %s\n", expanded, strerror(errno));
+  }
+  free(expanded);
+
+  if(ring == NULL) {
+    ring = calloc(EVENT_RING_SIZE, sizeof(ic_event_slot_t));
+    if(ring == NULL) {
+      EXIT_PRINT("Failed to allocate event ring\n");
+    }
+  }
+  log_pid = (uint32_t)getpid();
+  atomic_store(&enabled, true);
+  write_preamble();
+
+  drain_wake_fd = eventfd(0, EFD_CLOEXEC);
+  if(drain_wake_fd == -1) {
+    EXIT_PRINT("Failed to create eventfd: %s\n", strerror(errno));
+  }
+
+  // Block all signals in the drain thread so they are still delivered to the application threads
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  int err = pthread_create(&drain_thread, NULL, drain_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if(err != 0) {
+    EXIT_PRINT("Failed to create event log thread: %s\n", strerror(err));
+  }
+}
+
+// Stop the drain thread and write whatever is left, events recorded later are ignored
+void ic_event_log_stop(void) {
+  if(log_fd == -1) {
+    return;
+  }
+
+  uint64_t wake = 1;
+  if(write(drain_wake_fd, &wake, sizeof(wake)) == sizeof(wake)) {
+    pthread_join(drain_thread, NULL);
+  }
+  atomic_store(&enabled, false);
+  ic_event_log_flush();
+
+  close(drain_wake_fd);
+  close(log_fd);
+  drain_wake_fd = -1;
+  log_fd = -1;
+}
+
+// Called in a forked child, which has no drain thread and must not write the parent's events
+void ic_event_log_detach(void) {
+  atomic_store(&enabled, false);
+  if(log_fd != -1) {
+    close(log_fd);
+    close(drain_wake_fd);
+    log_fd = -1;
+    drain_wake_fd = -1;
+  }
+  atomic_flag_clear(&draining);
+}
@@ -0,0 +1,108 @@
+#include <signal.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "IntervalCheckInternal.h"
+#include "IntervalCheck.h"
+
+// Application heartbeat counters
+// Every thread claims its own cache line of counters on its first call so updates are plain
+// relaxed stores with no sharing between threads. Threads beyond IC_MAX_THREADS share the last
+// line and fall back to atomic adds. Readers sum a counter over all threads.
+
+uint64_t ic_heartbeat_timeout = 0;
+
+static ic_counters_t local_counters;
+static ic_counters_t *counters = &local_counters;
+
+static IC_TLS ic_thread_counters_t *thread_counters = NULL;
+static IC_TLS bool thread_shared = false;
+
+void ic_counters_attach(ic_counters_t *shared) {
+  counters = shared;
+}
+
+// Called in a forked child, its heartbeats must not land in the parent's counters
+// Only the forking thread exists in the child so only its claim needs dropping
+void ic_counters_detach(void) {
+  memset(&local_counters, 0, sizeof(local_counters));
+  counters = &local_counters;
+  thread_counters = NULL;
+  thread_shared = false;
+}
+
+static ic_thread_counters_t *claim_thread_counters() {
+  uint32_t index = atomic_fetch_add_explicit(&counters->thread_count, 1, memory_order_relaxed);
+  if(index >= IC_MAX_THREADS - 1) {
+    index = IC_MAX_THREADS - 1;
+    thread_shared = true;
+  }
+  thread_counters = &counters->threads[index];
+  return thread_counters;
+}
+
+IC_EXPORT void (ic_heartbeat)(int counter_id) {
+  ic_thread_counters_t *tc = thread_counters ? thread_counters : claim_thread_counters();
+  _Atomic uint64_t *value = &tc->value[(unsigned)counter_id % IC_MAX_COUNTERS];
+
+  if(thread_shared) {
+    atomic_fetch_add_explicit(value, 1, memory_order_relaxed);
+  } else {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + 1, memory_order_relaxed);
+  }
+}
+
+IC_EXPORT void (ic_progress)(int counter_id, uint64_t value) {
+  ic_thread_counters_t *tc = thread_counters ? thread_counters : claim_thread_counters();
+  atomic_store_explicit(&tc->value[(unsigned)counter_id % IC_MAX_COUNTERS], value, memory_order_relaxed);
+}
+
+// Sum each counter over the threads of c
+static void sum_counters(const ic_counters_t *c, uint64_t sums[IC_MAX_COUNTERS]) {
+  uint32_t threads = atomic_load_explicit(&c->thread_count, memory_order_relaxed);
+  if(threads > IC_MAX_THREADS) {
+    threads = IC_MAX_THREADS;
+  }
+
+  memset(sums, 0, IC_MAX_COUNTERS * sizeof(uint64_t));
+  for(uint32_t t=0; t<threads; t++) {
+    for(int id=0; id<IC_MAX_COUNTERS; id++) {
+      sums[id] += atomic_load_explicit(&c->threads[t].value[id], memory_order_relaxed);
+    }
+  }
+}
+
+IC_EXPORT void ic_heartbeat_totals(uint64_t totals[IC_MAX_COUNTERS]) {
+  sum_counters(counters, totals);
+}
+
+// Check that every counter in use has changed within the timeout, returns a stalled counter or -1
+int ic_counters_stalled(const ic_counters_t *c, ic_counter_watch_t *watch, uint64_t now) {
+  uint64_t sums[IC_MAX_COUNTERS];
+  sum_counters(c, sums);
+
+  int stalled = -1;
+  for(int id=0; id<IC_MAX_COUNTERS; id++) {
+    if(sums[id] != watch->seen[id] || watch->changed[id] == 0) {
+      watch->seen[id] = sums[id];
+      watch->changed[id] = now;
+    } else if(sums[id] != 0 && ic_heartbeat_timeout > 0 && now - watch->changed[id] > ic_heartbeat_timeout) {
+      stalled = id;
+    }
+  }
+
+  return stalled;
+}
+
+// Built in callback checking the counters of this process
+void ic_heartbeat_check(void) {
+  static ic_counter_watch_t watch;
+
+  uint64_t now = ic_now();
+  int stalled = ic_counters_stalled(counters, &watch, now);
+  if(stalled != -1) {
+    char reason[128];
+    snprintf(reason, sizeof(reason), "Heartbeat counter %d has not advanced for %.0f seconds", stalled,
+             (double)(now - watch.changed[stalled])/NSEC_PER_SEC);
+    ic_kill_job(reason);
+  }
+}
@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include "IntervalCheckInternal.h"
+
+// Isolated probes, the !isolate option
+// A check that can hang, such as one blocking in a wedged driver, runs in a helper process forked
+// when monitoring starts. The plugin is loaded and initialized in the helper only and each tick is
+// a request and reply over a socket pair. The monitor waits for the reply with a bounded poll, so
+// a hung probe only costs the helper, which is killed and replaced.
+
+// How long the monitor waits for a reply when the entry has no !timeout
+uint64_t ic_helper_timeout = 30*NSEC_PER_SEC;
+
+// Whether a tick may block waiting for the reply, cleared in IC_MODE_SIGNAL where the tick runs in
+// the SIGALRM handler on an application thread. The request is then left outstanding and its
+// reply collected by a later tick, the helper is only killed once the timeout has passed.
+bool ic_helper_wait = true;
+
+typedef struct {
+  uint64_t now;
+  uint64_t tick;
+  uint64_t period;
+} ic_helper_request_t;
+
+typedef struct {
+  int32_t status;
+  char message[256];
+} ic_helper_reply_t;
+
+// Set in the helper process
+static bool in_helper = false;
+
+// Helpers killed while stuck in an uninterruptible call, reaped once they finally exit
+static pid_t unreaped[MAX_CALLBACKS];
+static int unreaped_count = 0;
+
+static void reap_helpers() {
+  for(int i=unreaped_count-1; i>=0; i--) {
+    if(waitpid(unreaped[i], NULL, WNOHANG) != 0) {
+      unreaped[i] = unreaped[--unreaped_count];
+    }
+  }
+}
+
+// Run by the helper process until the monitor closes its end of the socket
+static void helper_main(ic_entry_t *entry, int fd) {
+  // Don't hold the sockets of other helpers open
+  for(int i=0; i<ic_entry_count; i++) {
+    if(ic_entries[i].helper_fd != -1) {
+      close(ic_entries[i].helper_fd);
+    }
+  }
+
+  // The helper is forked from whichever thread started monitoring, possibly an application thread
+  ic_affinity_apply();
+
+  // This copy of the entry loads and initializes the plugin in the helper
+  in_helper = true;
+  entry->isolate = false;
+  bool ready = ic_plugin_prepare(entry);
+
+  ic_helper_request_t request;
+  while(recv(fd, &request, sizeof(request), 0) == sizeof(request)) {
+    ic_helper_reply_t reply;
+    memset(&reply, 0, sizeof(reply));
+
+    const char *message = NULL;
+    if(!ready) {
+      reply.status = entry->status_pending ? entry->status : IC_STATUS_DISABLE;
+      message = entry->message ? entry->message : "could not be loaded";
+    } else if(entry->plugin) {
+      ic_tick_ctx_t ctx = { request.now, request.tick, request.period, entry->plugin_data, NULL };
+      reply.status = entry->plugin->tick(&ctx);
+      message = ctx.message;
+    } else {
+      (*entry->callback)();
+    }
+    if(message) {
+      snprintf(reply.message, sizeof(reply.message), "%s", message);
+    }
+
+    if(send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+      break;
+    }
+  }
+
+  if(entry->initialized && entry->plugin->finalize) {
+    entry->plugin->finalize(entry->plugin_data);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+// Whether the callbacks run in the monitored application rather than a helper or icd
+IC_EXPORT int ic_monitoring_self(void) {
+  return !in_helper && !ic_daemon;
+}
+
+// Fork the helper of entry if it isn't running, returns false if it couldn't be started
+bool ic_helper_start(ic_entry_t *entry) {
+  if(entry->helper_pid > 0) {
+    return true;
+  }
+  reap_helpers();
+
+  // A socket pair rather than pipes, a write to a dead helper must not raise SIGPIPE
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+    ERROR_PRINT("Failed to create helper socket for %s: %s\n", entry->name, strerror(errno));
+    return false;
+  }
+
+  pid_t pid = fork();
+  if(pid == -1) {
+    ERROR_PRINT("Failed to fork helper for %s: %s\n", entry->name, strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    helper_main(entry, fds[1]);
+  }
+
+  close(fds[1]);
+  entry->helper_pid = pid;
+  entry->helper_fd = fds[0];
+  DEBUG_PRINT("Started helper %d for %s\n", pid, entry->name);
+  return true;
+}
+
+// Stop the helper, killing it unless it exits within grace nanoseconds of its socket closing
+static void stop_helper(ic_entry_t *entry, uint64_t grace) {
+  if(entry->helper_pid <= 0) {
+    return;
+  }
+
+  close(entry->helper_fd);
+  entry->helper_fd = -1;
+  entry->helper_sent = 0;
+
+  uint64_t give_up = ic_now() + grace;
+  pid_t pid = entry->helper_pid;
+  entry->helper_pid = 0;
+  while(waitpid(pid, NULL, WNOHANG) == 0) {
+    if(ic_now() >= give_up) {
+      kill(pid, SIGKILL);
+      if(waitpid(pid, NULL, WNOHANG) == 0 && unreaped_count < MAX_CALLBACKS) {
+        unreaped[unreaped_count++] = pid;
+      }
+      break;
+    }
+    struct timespec interval = { 0, 1000000 };
+    nanosleep(&interval, NULL);
+  }
+}
+
+static bool send_request(ic_entry_t *entry, uint64_t now) {
+  ic_helper_request_t request = { now, entry->ticks, entry->period };
+  if(send(entry->helper_fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) {
+    return false;
+  }
+  entry->helper_sent = now;
+  return true;
+}
+
+// Run one tick of entry in its helper, replacing the helper if it died or didn't reply in time
+ic_status_t ic_helper_tick(ic_entry_t *entry, uint64_t now, const char **message) {
+  *message = entry->helper_message;
+  if(!ic_helper_start(entry)) {
+    snprintf(entry->helper_message, sizeof(entry->helper_message), "helper could not be started");
+    return IC_STATUS_WARN;
+  }
+
+  uint64_t timeout = entry->timeout > 0 ? entry->timeout : ic_helper_timeout;
+
+  struct pollfd reply_poll = { entry->helper_fd, POLLIN, 0 };
+  int ready = -1;
+  if(entry->helper_sent != 0 || send_request(entry, now)) {
+    uint64_t deadline = entry->helper_sent + timeout;
+    do {
+      uint64_t current = ic_now();
+      int wait_ms = ic_helper_wait && current < deadline ? (int)((deadline - current + 999999) / 1000000) : 0;
+      ready = poll(&reply_poll, 1, wait_ms);
+    } while(ready == -1 && errno == EINTR);
+
+    if(ready == 0 && !ic_helper_wait && ic_now() < deadline) {
+      // Still within its timeout, the reply is collected by a later tick
+      *message = NULL;
+      return IC_STATUS_OK;
+    }
+  }
+
+  if(ready == 0) {
+    ic_event(IC_EVENT_HELPER_KILLED, (uint16_t)(entry - ic_entries), 0, (uint64_t)entry->helper_pid);
+    stop_helper(entry, 0);
+    ic_helper_start(entry);
+    snprintf(entry->helper_message, sizeof(entry->helper_message), "did not respond within %.3fs",
+             (double)timeout/NSEC_PER_SEC);
+    return IC_STATUS_FAIL;
+  }
+
+  ic_helper_reply_t reply;
+  if(ready < 0 || recv(entry->helper_fd, &reply, sizeof(reply), 0) != sizeof(reply)) {
+    stop_helper(entry, 0);
+    ic_helper_start(entry);
+    snprintf(entry->helper_message, sizeof(entry->helper_message), "helper exited, restarted it");
+    return IC_STATUS_WARN;
+  }
+  entry->helper_sent = 0;
+
+  // Without waiting the next request goes out now so its reply is ready by the next tick
+  if(!ic_helper_wait) {
+    send_request(entry, now);
+  }
+
+  reply.message[sizeof(reply.message) - 1] = '\0';
+  memcpy(entry->helper_message, reply.message, sizeof(entry->helper_message));
+  if(reply.message[0] == '\0') {
+    *message = NULL;
+  }
+  return (ic_status_t)reply.status;
+}
+
+// Stop the helper at IC_finalize, giving it a moment to run the plugin's finalize
+void ic_helper_stop(ic_entry_t *entry) {
+  stop_helper(entry, NSEC_PER_SEC / 10);
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "IntervalCheckInternal.h"
+
+// Decoder for IC_EVENT_LOG files
+// Prints the events of every process in every file given, merged by wall clock time. Each process
+// starts its block with IC_EVENT_PROCESS, which pairs its monotonic clock with CLOCK_REALTIME, and
+// the names of its callbacks so that logs from several nodes can be read together.
+
+typedef struct {
+  int file;
+  uint32_t pid;
+  uint64_t monotonic;
+  uint64_t realtime;
+  int name_count;
+  char **names;
+} process_t;
+
+typedef struct {
+  uint64_t wall;  // CLOCK_REALTIME nanoseconds
+  size_t order;   // Position in the input, keeps the sort stable
+  size_t process;  // Index in processes, which moves as it grows
+  ic_event_record_t record;
+} decoded_t;
+
+static process_t *processes = NULL;
+static size_t process_count = 0;
+static decoded_t *events = NULL;
+static size_t event_count = 0;
+static size_t orphans = 0;
+
+static const char *status_names[] = { "OK", "WARN", "FAIL", "DISABLE" };
+
+static void *grow(void *array, size_t count, size_t size) {
+  // Double whenever count reaches a power of two
+  if(count == 0 || (count & (count - 1)) == 0) {
+    array = realloc(array, (count ? 2*count : 64) * size);
+    if(array == NULL) {
+      fprintf(stderr, "ic_events: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return array;
+}
+
+// The most recent process block of pid in file, pids are reused so later blocks win
+static process_t *find_process(int file, uint32_t pid) {
+  for(size_t i=process_count; i>0; i--) {
+    if(processes[i-1].file == file && processes[i-1].pid == pid) {
+      return &processes[i-1];
+    }
+  }
+  return NULL;
+}
+
+static void read_log(int file, const char *path) {
+  FILE *log = fopen(path, "rb");
+  if(log == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  ic_event_record_t record;
+  while(fread(&record, sizeof(record), 1, log) == 1) {
+    if(record.type == IC_EVENT_PROCESS) {
+      if(record.status != IC_EVENT_LOG_VERSION) {
+        fprintf(stderr, "%s: unsupported event log version %u\n", path, record.status);
+        exit(EXIT_FAILURE);
+      }
+      processes = grow(processes, process_count, sizeof(process_t));
+      process_t *process = &processes[process_count++];
+      *process = (process_t){ file, record.pid, record.time, record.value, record.id, NULL };
+      process->names = calloc(record.id, sizeof(char*));
+      continue;
+    }
+
+    process_t *process = find_process(file, record.pid);
+    if(record.type == IC_EVENT_NAME) {
+      // The name is stored in the records that follow
+      size_t length = (size_t)record.value;
+      size_t blocks = (length + sizeof(record) - 1) / sizeof(record);
+      char *name = calloc(blocks + 1, sizeof(record));
+      if(name == NULL || (blocks > 0 && fread(name, sizeof(record), blocks, log) != blocks)) {
+        free(name);
+        break;
+      }
+      name[length] = '\0';
+      if(process && record.id < process->name_count) {
+        process->names[record.id] = name;
+      } else {
+        free(name);
+      }
+      continue;
+    }
+
+    if(process == NULL) {
+      orphans++;
+      continue;
+    }
+    events = grow(events, event_count, sizeof(decoded_t));
+    events[event_count] = (decoded_t){ process->realtime + (record.time - process->monotonic), event_count,
+                                       (size_t)(process - processes), record };
+    event_count++;
+  }
+
+  fclose(log);
+}
+
+static int compare_events(const void *a, const void *b) {
+  const decoded_t *x = a, *y = b;
+  if(x->wall != y->wall) {
+    return x->wall < y->wall ? -1 : 1;
+  }
+  return x->order < y->order ? -1 : 1;
+}
+
+static const char *callback_name(const process_t *process, uint16_t index) {
+  if(index == IC_EVENT_NO_ENTRY) {
+    return "-";
+  }
+  if(index < process->name_count && process->names[index]) {
+    return process->names[index];
+  }
+  return "?";
+}
+
+// Format a duration in nanoseconds with a readable unit
+static const char *duration(char *buffer, size_t size, uint64_t ns) {
+  if(ns >= NSEC_PER_SEC) {
+    snprintf(buffer, size, "%.3fs", (double)ns/NSEC_PER_SEC);
+  } else if(ns >= 1000000) {
+    snprintf(buffer, size, "%.3fms", (double)ns/1e6);
+  } else {
+    snprintf(buffer, size, "%.3fus", (double)ns/1e3);
+  }
+  return buffer;
+}
+
+static void print_event(const decoded_t *event, uint64_t origin) {
+  const ic_event_record_t *r = &event->record;
+  const char *status = r->status < 4 ? status_names[r->status] : "?";
+  char d[32];
+
+  // Callback events name the callback in id, others the callback that was running
+  const char *callback = callback_name(&processes[event->process], r->type >= IC_EVENT_DISPATCH && r->type <= IC_EVENT_HELPER_KILLED
+                                                       ? r->id : r->entry);
+  printf("%12.6f %8u %-20s ", (double)(event->wall - origin)/NSEC_PER_SEC, r->pid, callback);
+
+  switch(r->type) {
+    case IC_EVENT_DROPPED:         printf("dropped         events=%llu\n", (unsigned long long)r->value); break;
+    case IC_EVENT_DISPATCH:        printf("dispatch        late=%s\n", duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_SKIP:            printf("skip\n"); break;
+    case IC_EVENT_TICK_START:      printf("tick_start      queued=%s\n", duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_TICK_END:        printf("tick_end        status=%s elapsed=%s\n", status, duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_OVERRUN:         printf("overrun         running=%s\n", duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_PERIOD:          printf("period          period=%s\n", duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_HELPER_KILLED:   printf("helper_killed   pid=%llu\n", (unsigned long long)r->value); break;
+    case IC_EVENT_ALIVE:           printf("alive           processes=%llu\n", (unsigned long long)r->value); break;
+    case IC_EVENT_LEADER:          printf("leader          pid=%llu\n", (unsigned long long)r->value); break;
+    case IC_EVENT_KILL_JOB:        printf("kill_job        requested=%s after=%s\n", r->status ? "yes" : "no",
+                                          duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_WATCHDOG_ARM:    printf("watchdog_arm    device=%u timeout=%s\n", r->id, duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_WATCHDOG_DISARM: printf("watchdog_disarm device=%u armed=%s\n", r->id, duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_FILE_BYTES:      printf("file_bytes      file=%u bytes=%llu\n", r->id, (unsigned long long)r->value); break;
+    case IC_EVENT_FILE_LINES:      printf("file_lines      file=%u lines=%llu\n", r->id, (unsigned long long)r->value); break;
+    case IC_EVENT_FILE_IDLE:       printf("file_idle       file=%u idle=%s\n", r->id, duration(d, sizeof(d), r->value)); break;
+    case IC_EVENT_NVML_REOPEN:     printf("nvml_reopen     device=%u error=%u reopen_error=%llu\n", r->id, r->status,
+                                          (unsigned long long)r->value); break;
+    default:
+      printf("event_%-9u id=%u status=%u value=%llu\n", r->type, r->id, r->status, (unsigned long long)r->value);
+  }
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2 || strcmp(argv[1], "-h") == 0) {
+    fprintf(stderr, "Usage: %s LOG...\nDecode IC_EVENT_LOG files, merging them by time\n", argv[0]);
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  for(int i=1; i<argc; i++) {
+    read_log(i, argv[i]);
+  }
+  if(process_count == 0) {
+    fprintf(stderr, "No event log records found\n");
+    return EXIT_FAILURE;
+  }
+
+  qsort(events, event_count, sizeof(decoded_t), compare_events);
+
+  // Times are relative to the first process starting
+  uint64_t origin = processes[0].realtime;
+  for(size_t i=1; i<process_count; i++) {
+    if(processes[i].realtime < origin) {
+      origin = processes[i].realtime;
+    }
+  }
+  time_t seconds = (time_t)(origin / NSEC_PER_SEC);
+  char start[64];
+  strftime(start, sizeof(start), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+  printf("# %zu events from %zu processes, times in seconds from %s.%06llu\n", event_count, process_count, start,
+         (unsigned long long)(origin % NSEC_PER_SEC) / 1000);
+  printf("# %10s %8s %-20s %s\n", "time", "pid", "callback", "event");
+
+  for(size_t i=0; i<event_count; i++) {
+    print_event(&events[i], origin);
+  }
+  if(orphans > 0) {
+    fprintf(stderr, "%zu records without a process record were skipped\n", orphans);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,37 @@
+#define _GNU_SOURCE
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <unistd.h>
+#include "IntervalCheckInternal.h"
+
+// icd, the node monitor daemon
+// Runs the callbacks and plugins configured by the usual IC_* variables in thread mode and watches
+// the processes started with IC_MODE=daemon, see Daemon.c. Start one per node before the job and
+// it exits once every registered process has gone, or on SIGINT or SIGTERM.
+
+int main(int argc, char **argv) {
+  if(argc > 1) {
+    fprintf(stderr, "Usage: %s\nConfigured through the IC_* environment variables\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Block the stop signals before any thread starts so only the serving loop sees them
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  sigaddset(&stop_signals, SIGHUP);
+  sigprocmask(SIG_BLOCK, &stop_signals, NULL);
+  int stop_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+  if(stop_fd == -1) {
+    EXIT_PRINT("signalfd failed\n");
+  }
+
+  ic_daemon = true;
+  ic_daemon_listen();
+  IC_init();
+  ic_daemon_serve(stop_fd);
+  IC_finalize();
+
+  return EXIT_SUCCESS;
+}
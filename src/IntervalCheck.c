@@ -1,5 +1,4 @@
 #include <sys/time.h>
-#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
@@ -11,120 +10,441 @@
 #include <string.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "IntervalCheckInternal.h"
+
+bool ic_debug = false;
+static bool ic_per_node = false;
+static uint64_t ic_interval = 60*5*NSEC_PER_SEC;
+
+// How callbacks are executed
+//   IC_MODE_SIGNAL: SIGALRM from a one shot ITIMER_REAL, callbacks run in the signal handler
+//   IC_MODE_THREAD: a dedicated monitor thread blocks on a timerfd and runs the callbacks
+// In both cases the timer is armed only for the next callback deadline
+typedef enum { IC_MODE_SIGNAL, IC_MODE_THREAD } ic_mode_t;
+static ic_mode_t ic_mode = IC_MODE_SIGNAL;
+
+// Callback statistics are written to ic_stats_path at IC_finalize, and every ic_stats_interval if set
+static const char *ic_stats_path = NULL;
+static uint64_t ic_stats_interval = 0;
+
+// Binary events of the monitoring process are appended to ic_event_log_path, see EventLog.c
+static const char *ic_event_log_path = NULL;
+
+// Which processes of a process tree monitor
+//   IC_SCOPE_PER_PROCESS: every process that loads the library
+//   IC_SCOPE_ROOT: only the root of each process tree, descendants stay quiescent
+//   IC_SCOPE_PER_NODE: one leader per node, descendants of a member process stay quiescent
+// The root exports IC_ROOT=<host>:<pid> so that exec'd descendants can recognise it
+typedef enum { IC_SCOPE_PER_PROCESS, IC_SCOPE_ROOT, IC_SCOPE_PER_NODE } ic_scope_t;
+static ic_scope_t ic_scope = IC_SCOPE_PER_PROCESS;
+
+// Set in processes that must not monitor or touch monitoring state, descendants of a monitored
+// process and children forked from one
+static bool quiescent = false;
+
+// Number of worker threads used to run callbacks concurrently in IC_MODE_THREAD
+static int ic_workers = 4;
+
+static bool timer_created = false;
+static pthread_t monitor_thread;
+static int monitor_timer_fd = -1;
+static int monitor_wake_fd = -1;
+static int monitor_refit_fd = -1;
 
-#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR Interval Check: %s:%d:%s(): " str, \
-		                               __FILE__, __LINE__, __func__, ##args); \
-	                              exit(EXIT_FAILURE); } while(0)
+static void *dl_handle = NULL;
 
-#define DEBUG_PRINT(str, args...) do {                                              \
-if(ic_debug == 1) {                                                                 \
-  printf("IC DEBUG: %s: %d: %s: " str, __FILENAME__, __LINE__, __func__, ##args); } \
-} while(0)
+// Set when IC_MODE=daemon handed monitoring to icd
+static bool daemon_client = false;
+
+// icd calls IC_init and IC_finalize from main rather than at load, ic_replay never calls them
+#if defined(IC_DAEMON) || defined(IC_REPLAY)
+#define IC_CONSTRUCTOR
+#define IC_DESTRUCTOR
+#else
+#define IC_CONSTRUCTOR __attribute__((__constructor__))
+#define IC_DESTRUCTOR __attribute__((__destructor__))
+#endif
+
+// Callbacks provided by the library itself, resolved before searching the process
+static const struct {
+  const char *name;
+  ic_callback_t callback;
+} builtin_callbacks[] = {
+  { "ic_node_ranks", ic_node_ranks_check },
+  { "ic_heartbeats", ic_heartbeat_check },
+  { "ic_stats", ic_stats_write },
+  { "icd_processes", ic_daemon_check },
+};
+
+// Arm the one shot ITIMER_REAL to fire at the absolute CLOCK_MONOTONIC time deadline
+static void arm_signal_timer(uint64_t deadline) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+
+  if(deadline != IC_NO_DEADLINE) {
+    uint64_t now = ic_now();
+    uint64_t remaining = deadline > now ? deadline - now : 0;
+    timer.it_value.tv_sec = remaining / NSEC_PER_SEC;
+    timer.it_value.tv_usec = (remaining % NSEC_PER_SEC) / 1000;
+    // If the initial value is 0 the timer won't begin
+    if(timer.it_value.tv_sec == 0 && timer.it_value.tv_usec == 0) {
+      timer.it_value.tv_usec = 1;
+    }
+  }
 
-static bool ic_debug = false;
-static bool ic_per_node = false;
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
 
-static void *dl_handle = NULL;
-static char *lock_file_name;
-static int lock_fd = -1;
+// Arm the one shot timerfd to fire at the absolute CLOCK_MONOTONIC time deadline
+static void arm_monitor_timer(uint64_t deadline) {
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
 
-typedef void (*ic_callback_t)(void);
+  if(deadline != IC_NO_DEADLINE) {
+    // A zero it_value disarms the timer so a deadline of 0 is nudged forward
+    if(deadline == 0) {
+      deadline = 1;
+    }
+    timer.it_value.tv_sec = deadline / NSEC_PER_SEC;
+    timer.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+  }
 
-#define MAX_CALLBACKS 1024
-static ic_callback_t callbacks[MAX_CALLBACKS];
-static int callback_count = 0;
+  if(timerfd_settime(monitor_timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0) {
+    EXIT_PRINT("Failed to set timerfd: %s\n", strerror(errno));
+  }
+}
 
-// Handler called by alarm at specified interval
+// Handler called by alarm when the next callback is due
 static void alarm_handler(int sig) {
-  DEBUG_PRINT("Handling callbacks\n");
+  ic_run_due(ic_now());
+  arm_signal_timer(ic_next_deadline());
+}
 
-  // Call all requested callbacks
-  for(int i=0; i<callback_count; i++) {
-    (*callbacks[i])();
+// Wake for whichever comes first, the next callback or a running callback's timeout
+static void arm_monitor_next() {
+  uint64_t next = ic_next_deadline();
+  uint64_t timeout = ic_check_timeouts(ic_now());
+  arm_monitor_timer(timeout < next ? timeout : next);
+}
+
+// Wake the monitor thread to refit the adaptive periods, called by a worker that measured a cost
+void ic_monitor_refit(void) {
+  uint64_t refit = 1;
+  if(monitor_refit_fd != -1 && write(monitor_refit_fd, &refit, sizeof(refit)) != sizeof(refit)) {
+    DEBUG_PRINT("WARNING: Failed to wake monitor thread: %s\n", strerror(errno));
   }
 }
 
-static void setup_timer() {
-  bool create_timer = true;
+// Body of the monitor thread used in IC_MODE_THREAD
+// Blocks on the timerfd until it expires, until a worker signals monitor_refit_fd or until
+// IC_finalize signals monitor_wake_fd
+static void *monitor_main(void *arg) {
+  // Move off the application's cores and drop our priority so the monitor doesn't compete with it
+  // SCHED_IDLE is only used on cpus the application can't run on, as a hung application spinning on every
+  // core would starve the check
+  ic_affinity_apply();
+
+  struct pollfd fds[3];
+  fds[0].fd = monitor_timer_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = monitor_wake_fd;
+  fds[1].events = POLLIN;
+  fds[2].fd = monitor_refit_fd;
+  fds[2].events = POLLIN;
+
+  while(true) {
+    int ready = poll(fds, 3, -1);
+    if(ready == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "ERROR Interval Check: monitor poll failed: %s\n", strerror(errno));
+      break;
+    }
 
-  // Create only one timer per node if specified
-  if(ic_per_node) {
-    // Determine absolute lock file path
-    lock_file_name = (char*)malloc(sizeof(char)*1024);
-    char tmp_dir[756] = "/tmp";
-    if(getenv("TMPDIR")){
-      strncpy(tmp_dir, getenv("TMPDIR"), 756);
+    // IC_finalize has requested shutdown
+    if(fds[1].revents & POLLIN) {
+      break;
+    }
+
+    if(fds[0].revents & POLLIN) {
+      uint64_t expirations;
+      if(read(monitor_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        ic_run_due(ic_now());
+        arm_monitor_next();
+      }
     }
-    sprintf(lock_file_name, "%s/interval_check.lock", tmp_dir);
 
-    // Create lock file if one doesn't exist
-    lock_fd = open(lock_file_name, O_CREAT|O_RDWR, S_IRUSR | S_IWUSR); 
-    // We don't check for a failure to create the file
-    // As a maximum of one process per node will be able to create it
+    // A shorter period may bring the next call forward
+    if(fds[2].revents & POLLIN) {
+      uint64_t refits;
+      if(read(monitor_refit_fd, &refits, sizeof(refits)) == sizeof(refits)) {
+        ic_refit_periods();
+        arm_monitor_next();
+      }
+    }
+  }
 
-    // Attempt to aquire lock on file
-    struct flock lock_struct;
-    memset(&lock_struct, 0, sizeof(lock_struct));
+  return NULL;
+}
 
-    lock_struct.l_type = F_WRLCK;
-    lock_struct.l_whence = SEEK_SET;
-    lock_struct.l_pid = getpid();
+// Create a timerfd on CLOCK_MONOTONIC and start the monitor thread blocking on it
+static void start_monitor_thread() {
+  monitor_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if(monitor_timer_fd == -1) {
+    EXIT_PRINT("Failed to create timerfd: %s\n", strerror(errno));
+  }
 
-    int locked = fcntl(lock_fd, F_SETLK, &lock_struct);
+  monitor_wake_fd = eventfd(0, EFD_CLOEXEC);
+  monitor_refit_fd = eventfd(0, EFD_CLOEXEC);
+  if(monitor_wake_fd == -1 || monitor_refit_fd == -1) {
+    EXIT_PRINT("Failed to create eventfd: %s\n", strerror(errno));
+  }
 
-    // If lock failed we aren't the first process on the node
-    // to reach this point so no timer is created
-    if(locked == -1) {
-      create_timer = false;
-    }
+  arm_monitor_timer(ic_next_deadline());
+
+  // Block all signals in the monitor so they are still delivered to the application threads
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  ic_pool_start(ic_workers < ic_entry_count ? ic_workers : ic_entry_count);
+  int err = pthread_create(&monitor_thread, NULL, monitor_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if(err != 0) {
+    EXIT_PRINT("Failed to create monitor thread: %s\n", strerror(err));
+  }
+}
+
+// Stop the monitor thread, waiting for any in progress callbacks to complete
+static void stop_monitor_thread() {
+  uint64_t wake = 1;
+  if(write(monitor_wake_fd, &wake, sizeof(wake)) != sizeof(wake)) {
+    DEBUG_PRINT("WARNING: Failed to wake monitor thread: %s\n", strerror(errno));
+  }
+
+  // A callback may call exit() from the monitor thread itself
+  if(!pthread_equal(pthread_self(), monitor_thread)) {
+    pthread_join(monitor_thread, NULL);
+  }
+
+  ic_pool_stop();
+
+  close(monitor_timer_fd);
+  close(monitor_wake_fd);
+  close(monitor_refit_fd);
+  monitor_timer_fd = -1;
+  monitor_wake_fd = -1;
+  monitor_refit_fd = -1;
+}
+
+static void setup_signal_timer() {
+  int err;
+  struct itimerval timer;
+
+  // Set handler for timer signal SIGALRM
+  struct sigaction action;
+  struct sigaction *old_action = NULL;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &alarm_handler;
+
+  err = sigaction(SIGALRM, &action, old_action);
+  if(old_action != NULL) {
+    EXIT_PRINT("Check GPU: SIGALRM already set\n");
+  }
+  if(err != 0) {
+    EXIT_PRINT("Failed to set SIGALM handler: %s\n", strerror(errno));
+  }
+
+  // Check if a ITIMER_REAL already is set
+  getitimer(ITIMER_REAL, &timer);
+  if(timer.it_interval.tv_sec  != 0 ||
+     timer.it_interval.tv_usec != 0 ||
+     timer.it_value.tv_sec     != 0 ||
+     timer.it_value.tv_usec    != 0) {
+    DEBUG_PRINT("WARNING: ITIMER_REAL already set, overwriting\n");
+  }
+
+  arm_signal_timer(ic_next_deadline());
+}
+
+// Schedule the callbacks and start the timer, in IC_PER_NODE mode only the node leader does this
+static void start_timer() {
+  if(ic_event_log_path) {
+    ic_event_log_start(ic_event_log_path);
   }
 
-  if (create_timer == true) {
-    int err;
-    struct itimerval timer;
+  // Resolved before plugin helpers are forked and before anything can fail
+  ic_kill_init();
 
-    // Set handler for timer signal SIGALRM
-    struct sigaction action;
-    struct sigaction *old_action = NULL;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = &alarm_handler;
+  // The SIGALRM handler must never block on an isolated check's helper
+  ic_helper_wait = ic_mode == IC_MODE_THREAD;
+
+  // Plugin setup runs here rather than on the first tick
+  ic_plugins_init();
+
+  ic_schedule_start(ic_now());
+  if(ic_mode == IC_MODE_THREAD) {
+    start_monitor_thread();
+  } else {
+    setup_signal_timer();
+  }
+  timer_created = true;
+}
+
+static void setup_timer() {
+  // Create only one timer per node if specified
+  // Every process joins the node segment, the elected leader starts the timer and the rest
+  // wait on the leader lock to take over if the leader exits
+  if(ic_per_node) {
+    ic_node_join(start_timer);
+  } else {
+    start_timer();
+  }
+}
 
-    err = sigaction(SIGALRM, &action, old_action);
-    if(old_action != NULL) {
-      EXIT_PRINT("Check GPU: SIGALRM already set\n");
+static bool find_callback(ic_entry_t *entry) {
+  for(size_t i=0; i<sizeof(builtin_callbacks)/sizeof(builtin_callbacks[0]); i++) {
+    if(strcmp(builtin_callbacks[i].name, entry->name) == 0) {
+      entry->callback = builtin_callbacks[i].callback;
+      return true;
     }
-    if(err != 0) {
-      EXIT_PRINT("Failed to set SIGALM handler: %s\n", strerror(errno));
+  }
+  return ic_plugin_resolve(entry, dl_handle);
+}
+
+static void add_builtin_callback(const char *name, ic_callback_t callback, uint64_t period) {
+  for(int i=0; i<ic_entry_count; i++) {
+    if(ic_entries[i].callback == callback) {
+      return;
     }
+  }
+  ic_add_entry(name, period)->callback = callback;
+}
 
-    // Check if a ITIMER_REAL already is set
-    getitimer(ITIMER_REAL, &timer);
-    if(timer.it_interval.tv_sec  != 0 ||
-       timer.it_interval.tv_usec != 0 ||
-       timer.it_value.tv_sec     != 0 ||
-       timer.it_value.tv_usec    != 0) {
-      DEBUG_PRINT("WARNING: ITIMER_REAL already set, overwriting\n");
+// Returns true if pid is the parent, or a further ancestor, of this process
+static bool is_ancestor(pid_t pid) {
+  pid_t current = getppid();
+  // Bounded in case of a cycle through a reused pid
+  for(int depth=0; current > 1 && depth < 64; depth++) {
+    if(current == pid) {
+      return true;
     }
 
-    // Set the timer interval
-    if(getenv("IC_INTERVAL")) {
-      timer.it_interval.tv_sec = atoi(getenv("IC_INTERVAL"));
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)current);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+      return false;
     }
-    else { // Default to 5 minutes
-      timer.it_interval.tv_sec = 60*5;
+    char stat[512];
+    ssize_t length = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if(length <= 0) {
+      return false;
     }
-    timer.it_interval.tv_usec = 0;
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = 1; // If the initial value is 0 the timer won't begin
+    stat[length] = '\0';
 
-    // Set the timer
-    err = setitimer(ITIMER_REAL, &timer, NULL);
-    if(err != 0) {
-      EXIT_PRINT("Failed to set timer: %s\n", strerror(errno));
+    // The command name may contain spaces, the parent pid follows the state after its last ')'
+    char *fields = strrchr(stat, ')');
+    int parent;
+    if(fields == NULL || sscanf(fields + 1, " %*c %d", &parent) != 1) {
+      return false;
     }
+    current = parent;
+  }
+  return false;
+}
 
+// Returns true if IC_ROOT names a process on this host that is an ancestor of this one
+// Launchers such as srun forward the environment to processes that aren't descendants, on this
+// node or others, so the marker alone isn't enough
+static bool monitored_by_ancestor() {
+  const char *root = getenv("IC_ROOT");
+  if(root == NULL) {
+    return false;
   }
+  const char *separator = strrchr(root, ':');
+  if(separator == NULL) {
+    return false;
+  }
+
+  char host[256];
+  if(gethostname(host, sizeof(host)) != 0) {
+    return false;
+  }
+  host[sizeof(host) - 1] = '\0';
+  size_t host_length = (size_t)(separator - root);
+  if(strlen(host) != host_length || strncmp(root, host, host_length) != 0) {
+    return false;
+  }
+
+  pid_t pid = (pid_t)atoi(separator + 1);
+  return pid > 0 && pid != getpid() && is_ancestor(pid);
+}
+
+// Decide whether this process monitors, returns false if it should stay quiescent
+// Runs before anything else in IC_init so descendants pay only for a few /proc reads
+static bool claim_scope() {
+  // IC_PER_NODE is kept as a shorthand for IC_SCOPE=per-node
+  if(getenv("IC_PER_NODE")) {
+    ic_scope = IC_SCOPE_PER_NODE;
+  }
+  if(getenv("IC_SCOPE")) {
+    const char *scope = getenv("IC_SCOPE");
+    if(strcmp(scope, "root") == 0) {
+      ic_scope = IC_SCOPE_ROOT;
+    } else if(strcmp(scope, "per-process") == 0) {
+      ic_scope = IC_SCOPE_PER_PROCESS;
+    } else if(strcmp(scope, "per-node") == 0) {
+      ic_scope = IC_SCOPE_PER_NODE;
+    } else {
+      EXIT_PRINT("Unknown IC_SCOPE: %s\n", scope);
+    }
+  }
+  ic_per_node = ic_scope == IC_SCOPE_PER_NODE;
+
+  if(ic_scope != IC_SCOPE_PER_PROCESS && monitored_by_ancestor()) {
+    return false;
+  }
+
+  char host[256];
+  if(gethostname(host, sizeof(host)) != 0) {
+    return true;
+  }
+  host[sizeof(host) - 1] = '\0';
+  char root[300];
+  snprintf(root, sizeof(root), "%s:%d", host, (int)getpid());
+  setenv("IC_ROOT", root, 1);
+
+  return true;
+}
+
+// A forked child shares the parent's eventfds, node segment slot and heartbeat counters but none
+// of its threads, it stays quiescent so that its exit can't stop or release the parent's monitor
+static void atfork_child() {
+  quiescent = true;
+  ic_counters_detach();
+  ic_event_log_detach();
+  ic_profile_detach();
+}
+
+// Sample the stacks of this process with IC_PROFILE=hz, independent of whether it runs the callbacks
+static void start_profile() {
+  if(!getenv("IC_PROFILE")) {
+    return;
+  }
+  char *end;
+  unsigned long hz = strtoul(getenv("IC_PROFILE"), &end, 10);
+  if(end == getenv("IC_PROFILE") || *end != '\0' || hz == 0 || hz > 10000) {
+    EXIT_PRINT("Invalid IC_PROFILE, expected samples per second up to 10000: %s\n", getenv("IC_PROFILE"));
+  }
+  const char *path = getenv("IC_PROFILE_OUTPUT") ? getenv("IC_PROFILE_OUTPUT") : "ic_profile.%h.%p.folded";
+  ic_profile_start(hz, path);
 }
 
 static void process_environment_variables() {
@@ -138,9 +458,86 @@ static void process_environment_variables() {
     ic_debug = true;
   }
 
-  // Check if a single check should be performed per node
-  if(getenv("IC_PER_NODE")) {
-    ic_per_node = true;
+  // Set the default callback period, default to 5 minutes
+  if(getenv("IC_INTERVAL")) {
+    if(!ic_parse_duration(getenv("IC_INTERVAL"), &ic_interval) || ic_interval == 0) {
+      EXIT_PRINT("Invalid IC_INTERVAL: %s\n", getenv("IC_INTERVAL"));
+    }
+  }
+
+  // Bound the wait for the reply of an isolated callback without its own !timeout
+  if(getenv("IC_HELPER_TIMEOUT")) {
+    if(!ic_parse_duration(getenv("IC_HELPER_TIMEOUT"), &ic_helper_timeout) || ic_helper_timeout == 0) {
+      EXIT_PRINT("Invalid IC_HELPER_TIMEOUT: %s\n", getenv("IC_HELPER_TIMEOUT"));
+    }
+  }
+
+  // Select how callbacks are executed
+  if(getenv("IC_MODE")) {
+    const char *mode = getenv("IC_MODE");
+    // daemon only gets here in icd itself or when no icd is running, both monitor from a thread
+    if(strcmp(mode, "thread") == 0 || strcmp(mode, "daemon") == 0) {
+      ic_mode = IC_MODE_THREAD;
+    } else if(strcmp(mode, "signal") == 0) {
+      ic_mode = IC_MODE_SIGNAL;
+    } else {
+      EXIT_PRINT("Unknown IC_MODE: %s\n", mode);
+    }
+  }
+
+  // Adapt the period of callbacks without an explicit @period to keep their combined
+  // duty cycle under IC_MAX_OVERHEAD, a fraction or a percentage
+  if(getenv("IC_MAX_OVERHEAD")) {
+    char *end;
+    ic_max_overhead = strtod(getenv("IC_MAX_OVERHEAD"), &end);
+    if(*end == '%') {
+      ic_max_overhead /= 100.0;
+      end++;
+    }
+    if(end == getenv("IC_MAX_OVERHEAD") || *end != '\0' || ic_max_overhead <= 0 || ic_max_overhead >= 1) {
+      EXIT_PRINT("Invalid IC_MAX_OVERHEAD: %s\n", getenv("IC_MAX_OVERHEAD"));
+    }
+  }
+  if(getenv("IC_MIN_INTERVAL")) {
+    if(!ic_parse_duration(getenv("IC_MIN_INTERVAL"), &ic_min_interval) || ic_min_interval == 0) {
+      EXIT_PRINT("Invalid IC_MIN_INTERVAL: %s\n", getenv("IC_MIN_INTERVAL"));
+    }
+  }
+  ic_max_interval = ic_interval;
+  if(getenv("IC_MAX_INTERVAL")) {
+    if(!ic_parse_duration(getenv("IC_MAX_INTERVAL"), &ic_max_interval) || ic_max_interval == 0) {
+      EXIT_PRINT("Invalid IC_MAX_INTERVAL: %s\n", getenv("IC_MAX_INTERVAL"));
+    }
+  }
+  if(ic_min_interval > ic_max_interval) {
+    ic_min_interval = ic_max_interval;
+  }
+
+  // Time an application heartbeat counter may stop changing before the process is killed
+  if(getenv("IC_HEARTBEAT_TIMEOUT")) {
+    if(!ic_parse_duration(getenv("IC_HEARTBEAT_TIMEOUT"), &ic_heartbeat_timeout)) {
+      EXIT_PRINT("Invalid IC_HEARTBEAT_TIMEOUT: %s\n", getenv("IC_HEARTBEAT_TIMEOUT"));
+    }
+  }
+
+  // Record callback execution time and timer jitter
+  if(getenv("IC_STATS")) {
+    ic_stats_path = getenv("IC_STATS");
+  }
+  if(getenv("IC_STATS_INTERVAL")) {
+    if(!ic_parse_duration(getenv("IC_STATS_INTERVAL"), &ic_stats_interval)) {
+      EXIT_PRINT("Invalid IC_STATS_INTERVAL: %s\n", getenv("IC_STATS_INTERVAL"));
+    }
+  }
+
+  // Record tick, status and plugin events in a binary log, decoded by ic_events
+  if(getenv("IC_EVENT_LOG")) {
+    ic_event_log_path = getenv("IC_EVENT_LOG");
+  }
+
+  // Number of callbacks that may run concurrently in thread mode, 0 runs them on the monitor thread
+  if(getenv("IC_WORKERS")) {
+    ic_workers = atoi(getenv("IC_WORKERS"));
   }
 
   // All callbacks must be loaded and visible to the process
@@ -149,52 +546,123 @@ static void process_environment_variables() {
     EXIT_PRINT("Error: %s\n", dlerror());
   }
 
-  callback_count = 0;
-  char *callback_name;
+  ic_entry_count = 0;
+  char *callback_spec;
   
-  char *names_env;
+  char *names_env = NULL;
   if(getenv("IC_CALLBACKS")) {
     names_env = strdup(getenv("IC_CALLBACKS"));
   } else {
-    fprintf(stderr, "IC_CALLBACKS not defined\n");
+    if(!getenv("IC_PLUGINS")) {
+      fprintf(stderr, "IC_CALLBACKS not defined\n");
+    }
   }
 
-  while ((callback_name = strsep(&names_env, ":"))) {
-    // Check if we've reached the maximum number of callbacks
-    if(callback_count == MAX_CALLBACKS) {
-      EXIT_PRINT("Callback count exceeded: %d\n", MAX_CALLBACKS);
+  char *names = names_env;
+  while ((callback_spec = strsep(&names, ":"))) {
+    // Allow an empty list when only built in callbacks are wanted
+    if(*callback_spec == '\0') {
+      continue;
     }
 
-    // Get function pointer to callback_name and append it to our list of callbacks
-    callbacks[callback_count] = (ic_callback_t)dlsym(dl_handle, callback_name);
+    // Parse the name and schedule, name[@period[+delay]]
+    ic_entry_t *entry = ic_add_entry(callback_spec, ic_interval);
 
-    // Check to make sure we have a valid function pointer
-    if(callbacks[callback_count] != NULL) {
-      callback_count++;
-      DEBUG_PRINT("Added function %s\n", callback_name);
+    // Find the plugin descriptor or function pointer for the callback name
+    if(find_callback(entry)) {
+      DEBUG_PRINT("Added %s %s every %.3fs after %.3fs\n", entry->plugin ? "plugin" : "function", entry->name,
+                  (double)entry->period/NSEC_PER_SEC, (double)entry->delay/NSEC_PER_SEC);
     } else {
-      EXIT_PRINT("Callback Function not found: %s\n", callback_name);
+      EXIT_PRINT("Callback Function not found: %s\n", entry->name);
     }
   }
   free(names_env);
+
+  // Plugins listed as library:callback[@period[+delay]][!option...], comma separated
+  // The libraries are only opened by the process that runs the callbacks
+  if(getenv("IC_PLUGINS")) {
+    char *plugins_env = strdup(getenv("IC_PLUGINS"));
+    char *plugins = plugins_env;
+    char *plugin_spec;
+    while((plugin_spec = strsep(&plugins, ","))) {
+      if(*plugin_spec == '\0') {
+        continue;
+      }
+
+      char *separator = strrchr(plugin_spec, ':');
+      if(separator == NULL || separator == plugin_spec) {
+        EXIT_PRINT("Expected library:callback in IC_PLUGINS: %s\n", plugin_spec);
+      }
+      *separator = '\0';
+
+      ic_entry_t *entry = ic_add_entry(separator + 1, ic_interval);
+      entry->library = strdup(plugin_spec);
+      DEBUG_PRINT("Added %s from %s every %.3fs after %.3fs\n", entry->name, entry->library,
+                  (double)entry->period/NSEC_PER_SEC, (double)entry->delay/NSEC_PER_SEC);
+    }
+    free(plugins_env);
+  }
+
+  // icd checks its registered processes and the node leader the local ranks, both including heartbeats
+  // Otherwise heartbeats are checked when a timeout is set, unless IC_CALLBACKS already schedules it
+  if(ic_daemon) {
+    add_builtin_callback("icd_processes", ic_daemon_check, ic_interval);
+  } else if(ic_per_node) {
+    add_builtin_callback("ic_node_ranks", ic_node_ranks_check, ic_interval);
+  } else if(ic_heartbeat_timeout > 0) {
+    add_builtin_callback("ic_heartbeats", ic_heartbeat_check, ic_interval);
+  }
+
+  // Statistics cover every callback, including the periodic writer itself
+  // The writer uses stdio and malloc, which would deadlock in the SIGALRM handler if the interrupted
+  // thread holds their locks, so with signals the summary is only written at IC_finalize
+  if(ic_stats_path) {
+    if(ic_stats_interval > 0 && ic_mode == IC_MODE_SIGNAL && !ic_daemon) {
+      ERROR_PRINT("IC_STATS_INTERVAL requires IC_MODE=thread, the summary is only written at exit\n");
+    } else if(ic_stats_interval > 0) {
+      add_builtin_callback("ic_stats", ic_stats_write, ic_stats_interval);
+    }
+    ic_stats_init(ic_stats_path);
+  }
 }
 
 static void destroy_timer() {
-  // Stop the timer
-  struct itimerval timer;
-  timer.it_interval.tv_sec = 0;
-  timer.it_interval.tv_usec = 0;
-  timer.it_value.tv_sec = 0;
-  timer.it_value.tv_usec = 0;
-  setitimer(ITIMER_REAL, &timer, NULL);
+  // Stop a standby process from becoming leader while the timer is torn down
+  ic_node_begin_leave();
 
-  // Return the alarm handler to default
-  signal(SIGALRM, SIG_DFL);
+  if(timer_created) {
+    if(ic_mode == IC_MODE_THREAD) {
+      stop_monitor_thread();
+    } else {
+      // Stop the timer
+      struct itimerval timer;
+      timer.it_interval.tv_sec = 0;
+      timer.it_interval.tv_usec = 0;
+      timer.it_value.tv_sec = 0;
+      timer.it_value.tv_usec = 0;
+      setitimer(ITIMER_REAL, &timer, NULL);
+
+      // Return the alarm handler to default
+      signal(SIGALRM, SIG_DFL);
+    }
+    timer_created = false;
 
-  // Close and delete lock file
-  close(lock_fd);
-  remove(lock_file_name); 
-  free(lock_file_name);
+    // A worker abandoned by ic_pool_stop may be terminating the job, or still be in a plugin whose
+    // entry is left running and isn't finalized or closed
+    ic_kill_wait();
+    ic_plugins_finalize();
+    ic_noise_report();
+
+    // Only the process that ran the callbacks has statistics to report
+    ic_stats_write();
+    ic_event_log_stop();
+  }
+
+  // Hand leadership to another process on the node
+  ic_node_leave();
+
+  // A termination started by a callback that returned while tearing down still ends the process
+  ic_kill_wait();
 
   // dlclose dl_handle
   dlclose(dl_handle);
@@ -202,15 +670,54 @@ static void destroy_timer() {
 
 // Entry point into the application
 // This will be run as soon as the library is loaded
-__attribute__ ((__constructor__))
-void IC_init() {
+IC_CONSTRUCTOR
+IC_EXPORT void IC_init() {
+  pthread_atfork(NULL, NULL, atfork_child);
+
+  if(getenv("IC_DEBUG")) {
+    ic_debug = true;
+  }
+
+  if(!ic_daemon) {
+    if(!claim_scope()) {
+      DEBUG_PRINT("Monitored by ancestor %s, not monitoring\n", getenv("IC_ROOT"));
+      quiescent = true;
+      return;
+    }
+
+    // Every monitored process profiles itself, including those handing their checks to icd
+    start_profile();
+
+    // Hand monitoring to the node's icd, falling back to a monitor thread if it isn't running
+    if(getenv("IC_MODE") && strcmp(getenv("IC_MODE"), "daemon") == 0) {
+      if(ic_daemon_register()) {
+        daemon_client = true;
+        return;
+      }
+      ERROR_PRINT("No icd running for this job, monitoring in process\n");
+    }
+  }
+
   process_environment_variables();
+
+  // icd never signals itself
+  if(ic_daemon) {
+    ic_mode = IC_MODE_THREAD;
+  }
   setup_timer();
 }
 
 // Exit point
 // Called when the library is unloaded
-__attribute__((destructor))
-void IC_finalize() {
+IC_DESTRUCTOR
+IC_EXPORT void IC_finalize() {
+  if(quiescent) {
+    return;
+  }
+  ic_profile_stop();
+  if(daemon_client) {
+    ic_daemon_unregister();
+    return;
+  }
   destroy_timer();
 }
@@ -0,0 +1,234 @@
+#ifndef INTERVAL_CHECK_INTERNAL_H
+#define INTERVAL_CHECK_INTERNAL_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include "IntervalCheck.h"
+
+#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+#define EXIT_PRINT(str, args...) do { fprintf(stderr, "ERROR Interval Check: %s:%d:%s(): " str, \
+		                               __FILE__, __LINE__, __func__, ##args); \
+	                              exit(EXIT_FAILURE); } while(0)
+
+#define DEBUG_PRINT(str, args...) do {                                              \
+if(ic_debug == 1) {                                                                 \
+  printf("IC DEBUG: %s: %d: %s: " str, __FILENAME__, __LINE__, __func__, ##args); } \
+} while(0)
+
+#define ERROR_PRINT(str, args...) do { fprintf(stderr, "ERROR Interval Check: " str, ##args); } while(0)
+
+#define SIGKILL_PRINT(str, args...) do { fprintf(stderr, "ERROR Interval Check: %s:%d:%s(): " str, \
+                                               __FILE__, __LINE__, __func__, ##args); \
+                                      raise(SIGKILL); } while(0)
+
+// The library is built with hidden visibility, only symbols marked IC_EXPORT are visible to the application
+#define IC_EXPORT __attribute__((visibility("default")))
+
+// The library is preloaded so static TLS is available, avoiding __tls_get_addr on every call
+#define IC_TLS __thread __attribute__((tls_model("initial-exec")))
+
+#define NSEC_PER_SEC 1000000000ULL
+#define IC_NO_DEADLINE UINT64_MAX
+
+typedef void (*ic_callback_t)(void);
+typedef uint64_t (*ic_clock_t)(void);
+typedef struct ic_entry_stats ic_entry_stats_t;
+
+#define MAX_CALLBACKS 1024
+#define IC_MAX_NAME_LENGTH 256
+#define IC_MAX_WORKERS 64
+#define IC_MAX_THREADS 64
+
+// A scheduled callback parsed from IC_CALLBACKS
+// All times are CLOCK_MONOTONIC nanoseconds
+typedef struct {
+  char name[IC_MAX_NAME_LENGTH];
+  ic_callback_t callback;        // Legacy void(void) callback, used when plugin is NULL
+  const ic_plugin_v2_t *plugin;
+  void *plugin_data;             // Set by the plugin's init
+  bool initialized;              // init has run and finalize is due
+  char *library;                 // IC_PLUGINS library the callback is loaded from, NULL if already loaded
+  void *library_handle;
+  bool lazy;                     // Load the library on the first tick rather than when monitoring starts
+  bool isolate;                  // Run in a helper process, see Helper.c
+  pid_t helper_pid;              // Running helper, 0 if none
+  int helper_fd;                 // Monitor end of the helper's socket, -1 if none
+  char helper_message[256];      // Message of the helper's last reply
+  uint64_t helper_sent;          // Time of the request awaiting a reply, 0 if none
+  uint64_t period;   // Time between calls
+  uint64_t delay;    // Time from IC_init until the first call
+  uint64_t deadline; // Absolute time of the next call
+  uint64_t last_dispatch; // Absolute time of the last call, 0 before the first
+  uint64_t timeout;  // Maximum run time before an overrun is reported, 0 for none
+  bool fixed_period; // Period given explicitly with @period, never adapted
+
+  // Measured cost, written by whichever thread runs the callback
+  uint64_t cost;                // Moving average of the execution time
+  unsigned long adjustments;    // Number of times the adaptive controller changed the period
+  uint64_t stolen;              // CPU time the callback used on application cpus, see Affinity.c
+
+  // Execution state, protected by the worker pool lock when the pool is running
+  bool running;          // Queued or executing, a new call is skipped until this clears
+  bool overrun_reported; // Current call has already been reported as overrunning
+  uint64_t started;      // Time the current call was dispatched
+  unsigned long skips;   // Calls skipped as the previous call hadn't finished
+  unsigned long overruns;
+  uint64_t ticks;
+
+  // Result of the last call, protected by the status lock in Plugin.c
+  ic_status_t status;
+  const char *message;
+  bool status_pending;   // Not yet acted on by ic_process_statuses
+  bool disabled;         // Dropped from the schedule
+
+  ic_entry_stats_t *stats; // Histograms, NULL unless IC_STATS is set
+} ic_entry_t;
+
+// Thread CPU time of a tick in progress, see Affinity.c
+typedef struct {
+  uint64_t cpu_time;
+  bool application; // Started on a cpu outside IC_CPUSET
+} ic_noise_probe_t;
+
+// Event log record, see EventLog.c
+// Records are appended to the log in blocks, each process's block starting with IC_EVENT_PROCESS
+#define IC_EVENT_LOG_VERSION 1
+#define IC_EVENT_NO_ENTRY UINT16_MAX
+
+typedef struct {
+  uint64_t time;   // CLOCK_MONOTONIC nanoseconds
+  uint64_t value;
+  uint32_t pid;
+  uint32_t status;
+  uint16_t type;   // ic_event_type_t
+  uint16_t id;
+  uint16_t entry;  // Index of the callback running on the recording thread, IC_EVENT_NO_ENTRY if none
+  uint16_t reserved;
+} ic_event_record_t;
+
+// Heartbeat counters of one thread, a single cache line
+typedef struct {
+  _Atomic uint64_t value[IC_MAX_COUNTERS];
+} __attribute__((aligned(64))) ic_thread_counters_t;
+
+// Heartbeat counters of one process
+typedef struct {
+  _Atomic uint32_t thread_count;
+  ic_thread_counters_t threads[IC_MAX_THREADS];
+} ic_counters_t;
+
+// Reader side state used to detect counters that stop changing
+typedef struct {
+  uint64_t seen[IC_MAX_COUNTERS];
+  uint64_t changed[IC_MAX_COUNTERS];
+} ic_counter_watch_t;
+
+extern bool ic_debug;
+extern bool ic_daemon;
+extern uint64_t ic_heartbeat_timeout;
+extern uint64_t ic_helper_timeout;
+extern bool ic_helper_wait;
+
+extern ic_entry_t ic_entries[MAX_CALLBACKS];
+extern int ic_entry_count;
+
+// Adaptive periods, enabled by a non zero ic_max_overhead
+extern double ic_max_overhead;
+extern uint64_t ic_min_interval;
+extern uint64_t ic_max_interval;
+
+// IntervalCheck.c
+void IC_init(void);
+void IC_finalize(void);
+void ic_monitor_refit(void);
+
+// Scheduler.c
+uint64_t ic_now(void);
+void ic_set_clock(ic_clock_t clock);
+bool ic_parse_duration(const char *str, uint64_t *ns);
+ic_entry_t *ic_add_entry(const char *spec, uint64_t default_period);
+void ic_schedule_start(uint64_t now);
+uint64_t ic_next_deadline(void);
+void ic_run_due(uint64_t now);
+void ic_refit_periods(void);
+bool ic_record_cost(ic_entry_t *entry, uint64_t elapsed);
+
+// WorkerPool.c
+void ic_pool_start(int worker_count);
+void ic_pool_stop(void);
+void ic_dispatch(ic_entry_t *entry);
+uint64_t ic_check_timeouts(uint64_t now);
+
+// NodeCoordinator.c
+void ic_node_join(void (*on_leader)(void));
+bool ic_node_begin_leave(void);
+void ic_node_leave(void);
+void ic_node_ranks_check(void);
+void ic_job_object_name(char *name, size_t size, const char *prefix);
+
+// Daemon.c
+bool ic_daemon_register(void);
+void ic_daemon_unregister(void);
+void ic_daemon_listen(void);
+void ic_daemon_serve(int stop_fd);
+void ic_daemon_check(void);
+void ic_daemon_kill_clients(void);
+
+// Plugin.c
+extern void (*ic_failure_handler)(const char *reason);
+bool ic_plugin_resolve(ic_entry_t *entry, void *handle);
+bool ic_plugin_prepare(ic_entry_t *entry);
+void ic_record_status(ic_entry_t *entry, ic_status_t status, const char *message);
+void ic_process_statuses(void);
+void ic_plugins_init(void);
+void ic_plugins_finalize(void);
+
+// Helper.c
+bool ic_helper_start(ic_entry_t *entry);
+ic_status_t ic_helper_tick(ic_entry_t *entry, uint64_t now, const char **message);
+void ic_helper_stop(ic_entry_t *entry);
+
+// KillJob.c
+void ic_kill_init(void);
+void ic_kill_job_over(pid_t pid, const char *reason) __attribute__((noreturn));
+void ic_kill_wait(void);
+
+// EventLog.c
+void ic_event_log_start(const char *path);
+void ic_event_log_flush(void);
+void ic_event_log_stop(void);
+void ic_event_log_detach(void);
+void ic_event_log_set_entry(const ic_entry_t *entry);
+
+// Profiler.c
+void ic_profile_start(unsigned long hz, const char *path);
+void ic_profile_stop(void);
+void ic_profile_detach(void);
+
+// Affinity.c
+void ic_affinity_apply(void);
+void ic_noise_begin(ic_noise_probe_t *probe);
+uint64_t ic_noise_end(const ic_noise_probe_t *probe);
+void ic_noise_report(void);
+
+// Stats.c
+char *ic_expand_path(const char *pattern);
+void ic_stats_init(const char *path);
+void ic_stats_record_exec(ic_entry_t *entry, uint64_t elapsed);
+void ic_stats_record_jitter(ic_entry_t *entry, uint64_t lateness);
+void ic_stats_record_stolen(ic_entry_t *entry, uint64_t stolen);
+void ic_stats_write(void);
+
+// Heartbeat.c
+void ic_counters_attach(ic_counters_t *shared);
+void ic_counters_detach(void);
+int ic_counters_stalled(const ic_counters_t *c, ic_counter_watch_t *watch, uint64_t now);
+void ic_heartbeat_check(void);
+
+#endif
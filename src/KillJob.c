@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include "IntervalCheckInternal.h"
+
+// Job termination
+// ic_kill_job asks the resource manager to end the whole job rather than only this process, since
+// a hang can leave the other ranks waiting on it until the allocation runs out. The backend is
+// chosen from IC_KILL_BACKEND when monitoring starts so nothing is looked up after a detection:
+//   alps   : ALPS low level interface request, libalpslli is opened with dlopen
+//   slurm  : scancel of the job step, or of the job from icd
+//   pgid   : SIGKILL to this process group
+//   script : runs IC_KILL_SCRIPT, a stand in for testing or site specific tools
+//   self   : SIGKILL to the monitored process, or every registered process in icd
+// The default, auto, picks alps or slurm from the environment and falls back to self. Every
+// backend except self is followed by SIGKILL to the monitored process once IC_KILL_GRACE passes.
+
+extern char **environ;
+
+typedef enum { IC_KILL_AUTO, IC_KILL_ALPS, IC_KILL_SLURM, IC_KILL_PGID, IC_KILL_SCRIPT, IC_KILL_SELF } ic_kill_backend_t;
+
+static const char *backend_names[] = { "auto", "alps", "slurm", "pgid", "script", "self" };
+
+#define ALPS_APP_LLI_ALPS_REQ_SIGNAL 1
+typedef int (*alps_request_t)(int request, void *data, size_t data_len);
+
+static ic_kill_backend_t backend = IC_KILL_AUTO;
+static alps_request_t alps_request = NULL;
+static const char *kill_script = NULL;
+static uint64_t kill_grace = 10*NSEC_PER_SEC;
+
+// Process the self backend kills, set before any helper is forked so helpers kill their parent
+static pid_t monitored_pid = 0;
+
+// Another process found stalled by the node leader or icd, killed along with the monitored process
+static _Atomic pid_t stalled_pid = 0;
+
+static atomic_bool killing = false;
+
+static bool select_alps() {
+  if(getenv("ALPS_APP_ID") == NULL) {
+    return false;
+  }
+  void *handle = dlopen("libalpslli.so", RTLD_NOW | RTLD_LOCAL);
+  if(handle) {
+    alps_request = (alps_request_t)dlsym(handle, "alps_app_lli_put_simple_request");
+  }
+  return alps_request != NULL;
+}
+
+// Resolve the termination backend, called when this process starts monitoring
+void ic_kill_init(void) {
+  monitored_pid = getpid();
+
+  if(getenv("IC_KILL_GRACE")) {
+    if(!ic_parse_duration(getenv("IC_KILL_GRACE"), &kill_grace)) {
+      EXIT_PRINT("Invalid IC_KILL_GRACE: %s\n", getenv("IC_KILL_GRACE"));
+    }
+  }
+
+  const char *name = getenv("IC_KILL_BACKEND") ? getenv("IC_KILL_BACKEND") : "auto";
+  backend = IC_KILL_SELF + 1;
+  for(int i=0; i<=IC_KILL_SELF; i++) {
+    if(strcmp(name, backend_names[i]) == 0) {
+      backend = i;
+    }
+  }
+
+  switch(backend) {
+    case IC_KILL_AUTO:
+      if(select_alps()) {
+        backend = IC_KILL_ALPS;
+      } else if(getenv("SLURM_JOB_ID")) {
+        backend = IC_KILL_SLURM;
+      } else {
+        backend = IC_KILL_SELF;
+      }
+      break;
+    case IC_KILL_ALPS:
+      if(!select_alps()) {
+        ERROR_PRINT("ALPS termination unavailable, falling back to SIGKILL\n");
+        backend = IC_KILL_SELF;
+      }
+      break;
+    case IC_KILL_SLURM:
+      if(getenv("SLURM_JOB_ID") == NULL) {
+        EXIT_PRINT("IC_KILL_BACKEND=slurm requires SLURM_JOB_ID\n");
+      }
+      break;
+    case IC_KILL_SCRIPT:
+      kill_script = getenv("IC_KILL_SCRIPT");
+      if(kill_script == NULL) {
+        EXIT_PRINT("IC_KILL_BACKEND=script requires IC_KILL_SCRIPT\n");
+      }
+      break;
+    case IC_KILL_PGID:
+    case IC_KILL_SELF:
+      break;
+    default:
+      EXIT_PRINT("Unknown IC_KILL_BACKEND: %s\n", name);
+  }
+
+  DEBUG_PRINT("Job termination through %s\n", backend_names[backend]);
+}
+
+// Only the first process on the node to fail sends the job wide request, the resource manager
+// ends the others anyway. The claim is an flock on a marker named after the job step, released by
+// the kernel when the claiming process exits, so a later step or a later run under the same job
+// name requests termination again.
+static bool claim_node_request() {
+  char name[192];
+  ic_job_object_name(name, sizeof(name), "/interval_check_kill");
+  if(getenv("SLURM_STEP_ID")) {
+    size_t length = strlen(name);
+    snprintf(name + length, sizeof(name) - length, ".%s", getenv("SLURM_STEP_ID"));
+  }
+
+  // The descriptor is left open, the claim lasts until this process is killed
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if(fd == -1) {
+    return true;
+  }
+  if(flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    int err = errno;
+    close(fd);
+    return err != EWOULDBLOCK;
+  }
+  return true;
+}
+
+// Environment of spawned commands, the application's without LD_PRELOAD or IC_* variables so the
+// command doesn't start monitoring itself, plus extra. Built in static storage as ic_kill_job can
+// be reached from the SIGALRM handler.
+#define IC_MAX_COMMAND_ENV 4096
+static char *command_env[IC_MAX_COMMAND_ENV];
+
+static char **command_environment(char *const extra[]) {
+  int count = 0;
+  for(char **variable = environ; *variable && count < IC_MAX_COMMAND_ENV - 8; variable++) {
+    if(strncmp(*variable, "LD_PRELOAD=", 11) != 0 && strncmp(*variable, "IC_", 3) != 0) {
+      command_env[count++] = *variable;
+    }
+  }
+  for(int i=0; extra && extra[i] && count < IC_MAX_COMMAND_ENV - 1; i++) {
+    command_env[count++] = extra[i];
+  }
+  command_env[count] = NULL;
+  return command_env;
+}
+
+// Run argv and wait for it until the grace period ends, returns true if it exited successfully
+static bool run_command(char *const argv[], char *const extra_env[], uint64_t give_up) {
+  pid_t pid;
+  int err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, command_environment(extra_env));
+  if(err != 0) {
+    ERROR_PRINT("Failed to run %s: %s\n", argv[0], strerror(err));
+    return false;
+  }
+
+  int status;
+  while(waitpid(pid, &status, WNOHANG) == 0) {
+    if(ic_now() >= give_up) {
+      ERROR_PRINT("%s did not finish\n", argv[0]);
+      return false;
+    }
+    struct timespec interval = { 0, 1000000 };
+    nanosleep(&interval, NULL);
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool request_termination(const char *reason, uint64_t give_up) {
+  switch(backend) {
+    case IC_KILL_ALPS: {
+      int32_t buf[2] = { SIGKILL, -1 };
+      return alps_request(ALPS_APP_LLI_ALPS_REQ_SIGNAL, buf, sizeof(buf)) == 0;
+    }
+    case IC_KILL_SLURM: {
+      // Kill the step of the monitored process, icd runs in a step of its own so it cancels the job
+      char step[128];
+      if(getenv("SLURM_STEP_ID") && !ic_daemon) {
+        snprintf(step, sizeof(step), "%s.%s", getenv("SLURM_JOB_ID"), getenv("SLURM_STEP_ID"));
+        char *argv[] = { "scancel", "--signal=KILL", step, NULL };
+        return run_command(argv, NULL, give_up);
+      }
+      snprintf(step, sizeof(step), "%s", getenv("SLURM_JOB_ID"));
+      char *argv[] = { "scancel", step, NULL };
+      return run_command(argv, NULL, give_up);
+    }
+    case IC_KILL_PGID:
+      return kill(0, SIGKILL) == 0;
+    case IC_KILL_SCRIPT: {
+      static char pid[32];
+      static char reason_variable[300];
+      snprintf(pid, sizeof(pid), "IC_KILL_PID=%d", (int)(stalled_pid > 0 ? stalled_pid : monitored_pid));
+      snprintf(reason_variable, sizeof(reason_variable), "IC_KILL_REASON=%s", reason);
+      char *extra_env[] = { pid, reason_variable, NULL };
+      char *argv[] = { (char*)kill_script, (char*)reason, NULL };
+      return run_command(argv, extra_env, give_up);
+    }
+    default:
+      return false;
+  }
+}
+
+static void kill_monitored() {
+  if(ic_daemon) {
+    ic_daemon_kill_clients();
+  }
+  if(stalled_pid > 0) {
+    kill(stalled_pid, SIGKILL);
+  }
+  kill(monitored_pid ? monitored_pid : getpid(), SIGKILL);
+  raise(SIGKILL);
+}
+
+// Terminate the job, never returns
+// Concurrent and repeated calls wait for the first to finish the job
+IC_EXPORT void ic_kill_job(const char *reason) {
+  uint64_t detected = ic_now();
+
+  if(atomic_exchange(&killing, true)) {
+    while(true) {
+      pause();
+    }
+  }
+
+  char message[256];
+  snprintf(message, sizeof(message), "%s", reason ? reason : "check failed");
+  size_t length = strlen(message);
+  while(length > 0 && message[length-1] == '\n') {
+    message[--length] = '\0';
+  }
+
+  if(backend == IC_KILL_AUTO) {
+    // Monitoring never started in this process, e.g. a plugin running on its own
+    ic_kill_init();
+  }
+
+  ERROR_PRINT("Terminating job through %s: %s\n", backend_names[backend], message);
+  if(backend != IC_KILL_SELF) {
+    uint64_t give_up = detected + kill_grace;
+    if(!claim_node_request()) {
+      ERROR_PRINT("Termination already requested on this node\n");
+    } else if(request_termination(message, give_up)) {
+      ERROR_PRINT("Termination requested through %s in %.3fms\n", backend_names[backend],
+                  (double)(ic_now() - detected)/1e6);
+      ic_event(IC_EVENT_KILL_JOB, 0, 1, ic_now() - detected);
+    } else {
+      ERROR_PRINT("Termination through %s failed after %.3fms\n", backend_names[backend],
+                  (double)(ic_now() - detected)/1e6);
+      ic_event(IC_EVENT_KILL_JOB, 0, 0, ic_now() - detected);
+      give_up = ic_now();
+    }
+
+    // The resource manager may end this process at any point from here
+    ic_event_log_flush();
+
+    // Give the resource manager the grace period to end the job before ending this process
+    while(ic_now() < give_up) {
+      struct timespec interval = { 0, 10000000 };
+      nanosleep(&interval, NULL);
+    }
+    ERROR_PRINT("Still running %.3fs after detection, killing this process\n", (double)(ic_now() - detected)/NSEC_PER_SEC);
+  }
+
+  if(backend == IC_KILL_SELF) {
+    ic_event(IC_EVENT_KILL_JOB, 0, 1, ic_now() - detected);
+  }
+  ic_event_log_flush();
+  kill_monitored();
+  while(true) {
+    pause();
+  }
+}
+
+// Called as monitoring stops, a termination already under way on another thread is left to finish
+// rather than the process exiting normally
+void ic_kill_wait(void) {
+  if(atomic_load(&killing)) {
+    DEBUG_PRINT("Job termination in progress, waiting for it\n");
+    while(true) {
+      pause();
+    }
+  }
+}
+
+// Terminate the job over a stalled process, which the self backend and the final SIGKILL also kill
+void ic_kill_job_over(pid_t pid, const char *reason) {
+  pid_t none = 0;
+  atomic_compare_exchange_strong(&stalled_pid, &none, pid);
+  ic_kill_job(reason);
+}
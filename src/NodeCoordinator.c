@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include "IntervalCheckInternal.h"
+
+// Node local coordination for IC_PER_NODE
+// Every process on the node attaches to one shared memory segment. Leadership is a robust,
+// process shared mutex held by the leader's coordinator thread, so when the leader exits,
+// cleanly or not, exactly one waiting process acquires it and takes over the callbacks.
+// Every process keeps its liveness and heartbeat counters in a slot of the segment that the
+// leader checks in a single pass.
+
+#define IC_NODE_MAGIC 0x49434e31
+#define IC_NODE_VERSION 2
+#define IC_MAX_LOCAL_RANKS 256
+
+enum { IC_RANK_FREE = 0, IC_RANK_ALIVE, IC_RANK_EXITED, IC_RANK_DEAD };
+
+typedef struct {
+  _Atomic int32_t pid;
+  _Atomic uint32_t state;
+  ic_counters_t counters __attribute__((aligned(64)));
+} ic_rank_slot_t;
+
+typedef struct {
+  _Atomic uint32_t magic;
+  uint32_t version;
+  _Atomic int32_t leader_pid;
+  pthread_mutex_t leader_lock;
+  ic_rank_slot_t ranks[IC_MAX_LOCAL_RANKS];
+} ic_node_segment_t;
+
+static ic_node_segment_t *segment = NULL;
+static char segment_name[128];
+static ic_rank_slot_t *my_slot = NULL;
+
+static pthread_t coordinator;
+static int coordinator_wake_fd = -1;
+static void (*become_leader)(void) = NULL;
+
+// Serialises becoming leader against IC_finalize
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool shutting_down = false;
+static bool leader = false;
+
+// Heartbeats seen for each rank by the leader
+static struct {
+  int32_t pid;
+  ic_counter_watch_t watch;
+} seen[IC_MAX_LOCAL_RANKS];
+
+// Name a per node object after the user and job so separate jobs sharing a node don't collide
+void ic_job_object_name(char *name, size_t size, const char *prefix) {
+  const char *job = "default";
+  const char *job_variables[] = { "PBS_JOBID", "SLURM_JOB_ID", "ALPS_APP_ID", "LSB_JOBID" };
+  for(size_t i=0; i<sizeof(job_variables)/sizeof(job_variables[0]); i++) {
+    if(getenv(job_variables[i])) {
+      job = getenv(job_variables[i]);
+      break;
+    }
+  }
+
+  snprintf(name, size, "%s.%u.%s", prefix, (unsigned)getuid(), job);
+  for(char *c = name + strlen(prefix); *c; c++) {
+    if(*c == '/') {
+      *c = '_';
+    }
+  }
+}
+
+static void init_segment(ic_node_segment_t *seg) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&seg->leader_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  seg->version = IC_NODE_VERSION;
+  atomic_store_explicit(&seg->magic, IC_NODE_MAGIC, memory_order_release);
+}
+
+// Create or attach to the node segment, the creator initialises it
+static void attach_segment() {
+  ic_job_object_name(segment_name, sizeof(segment_name), "/interval_check");
+
+  bool creator = true;
+  int fd = shm_open(segment_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if(fd == -1 && errno == EEXIST) {
+    creator = false;
+    fd = shm_open(segment_name, O_RDWR, S_IRUSR | S_IWUSR);
+  }
+  if(fd == -1) {
+    EXIT_PRINT("Failed to open shared memory segment %s: %s\n", segment_name, strerror(errno));
+  }
+
+  if(creator && ftruncate(fd, sizeof(ic_node_segment_t)) != 0) {
+    EXIT_PRINT("Failed to size shared memory segment %s: %s\n", segment_name, strerror(errno));
+  }
+
+  // Wait for the creator to size the segment
+  struct stat st;
+  struct timespec interval = { 0, 1000000 };
+  while(fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(ic_node_segment_t)) {
+    nanosleep(&interval, NULL);
+  }
+
+  segment = mmap(NULL, sizeof(ic_node_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(segment == MAP_FAILED) {
+    EXIT_PRINT("Failed to map shared memory segment %s: %s\n", segment_name, strerror(errno));
+  }
+
+  if(creator) {
+    init_segment(segment);
+  } else {
+    while(atomic_load_explicit(&segment->magic, memory_order_acquire) != IC_NODE_MAGIC) {
+      nanosleep(&interval, NULL);
+    }
+    if(segment->version != IC_NODE_VERSION) {
+      EXIT_PRINT("Incompatible shared memory segment %s version %u\n", segment_name, segment->version);
+    }
+  }
+}
+
+static bool process_alive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Claim a free slot, or one left behind by a process that has exited
+static void claim_slot() {
+  int32_t pid = getpid();
+
+  for(int i=0; i<IC_MAX_LOCAL_RANKS; i++) {
+    ic_rank_slot_t *slot = &segment->ranks[i];
+    int32_t owner = atomic_load(&slot->pid);
+    uint32_t state = atomic_load(&slot->state);
+
+    bool reusable = owner == 0 || state == IC_RANK_EXITED || state == IC_RANK_DEAD || !process_alive(owner);
+    if(reusable && atomic_compare_exchange_strong(&slot->pid, &owner, pid)) {
+      memset(&slot->counters, 0, sizeof(slot->counters));
+      atomic_store_explicit(&slot->state, IC_RANK_ALIVE, memory_order_release);
+      my_slot = slot;
+      ic_counters_attach(&slot->counters);
+      return;
+    }
+  }
+
+  ERROR_PRINT("No free slot in %s, this process will not be monitored by the node leader\n", segment_name);
+}
+
+// Waits, without polling, for leadership and then holds it until IC_finalize
+static void *coordinator_main(void *arg) {
+  ic_affinity_apply();
+
+  int err = pthread_mutex_lock(&segment->leader_lock);
+  if(err == EOWNERDEAD) {
+    DEBUG_PRINT("Previous leader %d died, taking over\n", atomic_load(&segment->leader_pid));
+    pthread_mutex_consistent(&segment->leader_lock);
+  } else if(err != 0) {
+    ERROR_PRINT("Failed to acquire node leadership: %s\n", strerror(err));
+    return NULL;
+  }
+
+  pthread_mutex_lock(&state_lock);
+  if(!shutting_down) {
+    leader = true;
+    atomic_store(&segment->leader_pid, getpid());
+    DEBUG_PRINT("Process %d is the node leader\n", getpid());
+    become_leader();
+    ic_event(IC_EVENT_LEADER, 0, 0, (uint64_t)getpid());
+  }
+  pthread_mutex_unlock(&state_lock);
+
+  // Hold leadership until IC_finalize, a standby that won the lock while shutting down gives it straight back
+  if(leader) {
+    uint64_t wake;
+    while(read(coordinator_wake_fd, &wake, sizeof(wake)) == -1 && errno == EINTR);
+    atomic_store(&segment->leader_pid, 0);
+  }
+
+  pthread_mutex_unlock(&segment->leader_lock);
+  return NULL;
+}
+
+// Join the node, on_leader is called from the coordinator thread if and when this process becomes leader
+void ic_node_join(void (*on_leader)(void)) {
+  become_leader = on_leader;
+
+  attach_segment();
+  claim_slot();
+
+  coordinator_wake_fd = eventfd(0, EFD_CLOEXEC);
+  if(coordinator_wake_fd == -1) {
+    EXIT_PRINT("Failed to create eventfd: %s\n", strerror(errno));
+  }
+
+  // The coordinator and any threads it starts never take application signals
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  int err = pthread_create(&coordinator, NULL, coordinator_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if(err != 0) {
+    EXIT_PRINT("Failed to create coordinator thread: %s\n", strerror(err));
+  }
+}
+
+// Stop this process from becoming leader, returns true if it already is
+// The caller must stop the callbacks before calling ic_node_leave
+bool ic_node_begin_leave(void) {
+  if(segment == NULL) {
+    return false;
+  }
+
+  pthread_mutex_lock(&state_lock);
+  shutting_down = true;
+  bool was_leader = leader;
+  pthread_mutex_unlock(&state_lock);
+
+  return was_leader;
+}
+
+// Release leadership so a standby process takes over and detach from the segment
+void ic_node_leave(void) {
+  if(segment == NULL) {
+    return;
+  }
+
+  if(leader) {
+    uint64_t wake = 1;
+    if(write(coordinator_wake_fd, &wake, sizeof(wake)) == sizeof(wake) &&
+       !pthread_equal(pthread_self(), coordinator)) {
+      pthread_join(coordinator, NULL);
+    }
+  } else {
+    // A standby coordinator is blocked acquiring the lock and is left to exit with the process
+    pthread_detach(coordinator);
+  }
+
+  if(my_slot) {
+    atomic_store_explicit(&my_slot->state, IC_RANK_EXITED, memory_order_release);
+  }
+
+  // The last live process to leave removes the segment, including after ranks that crashed
+  bool last = true;
+  for(int i=0; i<IC_MAX_LOCAL_RANKS && last; i++) {
+    ic_rank_slot_t *slot = &segment->ranks[i];
+    last = atomic_load(&slot->state) != IC_RANK_ALIVE || !process_alive(atomic_load(&slot->pid));
+  }
+  if(last) {
+    shm_unlink(segment_name);
+  }
+
+  // The mapping is kept as application threads may still be updating heartbeat counters in it
+  segment = NULL;
+  my_slot = NULL;
+}
+
+// Built in callback run by the node leader, checks every local rank in one pass over the segment
+// Ranks that died without reaching IC_finalize are reported and ranks whose heartbeats stall are killed
+void ic_node_ranks_check(void) {
+  if(segment == NULL) {
+    return;
+  }
+
+  int alive = 0;
+  for(int i=0; i<IC_MAX_LOCAL_RANKS; i++) {
+    ic_rank_slot_t *slot = &segment->ranks[i];
+    if(atomic_load_explicit(&slot->state, memory_order_acquire) != IC_RANK_ALIVE) {
+      continue;
+    }
+
+    int32_t pid = atomic_load(&slot->pid);
+    if(!process_alive(pid)) {
+      atomic_store(&slot->state, IC_RANK_DEAD);
+      ERROR_PRINT("Local rank %d exited without finalizing\n", pid);
+      continue;
+    }
+
+    if(seen[i].pid != pid) {
+      memset(&seen[i], 0, sizeof(seen[i]));
+      seen[i].pid = pid;
+    }
+
+    uint64_t now = ic_now();
+    int stalled = ic_counters_stalled(&slot->counters, &seen[i].watch, now);
+    if(stalled != -1) {
+      char reason[128];
+      snprintf(reason, sizeof(reason), "Local rank %d heartbeat counter %d has not advanced for %.0f seconds", pid,
+               stalled, (double)(now - seen[i].watch.changed[stalled])/NSEC_PER_SEC);
+      ic_kill_job_over(pid, reason);
+    }
+    alive++;
+  }
+
+  ic_event(IC_EVENT_ALIVE, 0, 0, (uint64_t)alive);
+}
@@ -0,0 +1,173 @@
+#include <pthread.h>
+#include <dlfcn.h>
+#include "IntervalCheckInternal.h"
+
+// Versioned plugin interface
+// A callback name resolves to an ic_plugin_v2_t descriptor exported as <name>_plugin, falling back
+// to a plain void <name>(void) function. Tick statuses are recorded as calls complete and acted on
+// together by ic_process_statuses, so the failures of every check in a round are reported at once.
+
+#define IC_PLUGIN_SUFFIX "_plugin"
+
+static pthread_mutex_t status_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called instead of ic_kill_job when set, ic_replay records the detection and ends the scenario
+void (*ic_failure_handler)(const char *reason) = NULL;
+
+// Resolve entry->name in handle, returns false if neither a descriptor nor a function is found
+bool ic_plugin_resolve(ic_entry_t *entry, void *handle) {
+  char symbol[IC_MAX_NAME_LENGTH + sizeof(IC_PLUGIN_SUFFIX)];
+  snprintf(symbol, sizeof(symbol), "%s" IC_PLUGIN_SUFFIX, entry->name);
+
+  const ic_plugin_v2_t *plugin = dlsym(handle, symbol);
+  if(plugin) {
+    if(plugin->abi_version != IC_PLUGIN_ABI_VERSION || plugin->tick == NULL) {
+      EXIT_PRINT("%s has unsupported plugin ABI version %u\n", symbol, plugin->abi_version);
+    }
+    entry->plugin = plugin;
+    return true;
+  }
+
+  entry->callback = (ic_callback_t)dlsym(handle, entry->name);
+  return entry->callback != NULL;
+}
+
+// Load the IC_PLUGINS library of entry and run the plugin's init, or start its helper if isolated
+// Libraries are opened RTLD_LOCAL so their symbols, and those of their dependencies, never
+// interpose on the application. Returns false if the entry can't run and has been disabled.
+bool ic_plugin_prepare(ic_entry_t *entry) {
+  // An isolated plugin is only loaded by its helper
+  if(entry->isolate) {
+    return ic_helper_start(entry);
+  }
+
+  if(entry->library && entry->library_handle == NULL) {
+    DEBUG_PRINT("Loading %s from %s\n", entry->name, entry->library);
+    entry->library_handle = dlopen(entry->library, RTLD_NOW | RTLD_LOCAL);
+    if(entry->library_handle == NULL) {
+      ERROR_PRINT("Failed to load %s: %s\n", entry->library, dlerror());
+      entry->disabled = true;
+      return false;
+    }
+    if(!ic_plugin_resolve(entry, entry->library_handle)) {
+      ERROR_PRINT("Callback Function not found: %s in %s\n", entry->name, entry->library);
+      entry->disabled = true;
+      return false;
+    }
+  }
+
+  if(entry->plugin && !entry->initialized) {
+    ic_status_t status = IC_STATUS_OK;
+    if(entry->plugin->init) {
+      DEBUG_PRINT("Initializing %s\n", entry->name);
+      status = entry->plugin->init(&entry->plugin_data);
+    }
+    entry->initialized = status == IC_STATUS_OK;
+    if(status != IC_STATUS_OK) {
+      // Without a completed init the plugin is never ticked, whatever the status
+      entry->disabled = true;
+      ic_record_status(entry, status, status == IC_STATUS_DISABLE ? "not running in this process" : "initialization failed");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Record the result of a call, must only be called by the thread that ran it
+void ic_record_status(ic_entry_t *entry, ic_status_t status, const char *message) {
+  if(status == IC_STATUS_OK) {
+    return;
+  }
+
+  pthread_mutex_lock(&status_lock);
+  entry->status = status;
+  entry->message = message;
+  entry->status_pending = true;
+  pthread_mutex_unlock(&status_lock);
+}
+
+// Act on every status recorded since the last call
+// Warnings are reported, disabled entries are dropped from the schedule and if any check failed
+// they are all reported before the job is terminated
+void ic_process_statuses(void) {
+  int failures = 0;
+
+  pthread_mutex_lock(&status_lock);
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    if(!entry->status_pending) {
+      continue;
+    }
+    entry->status_pending = false;
+
+    const char *message = entry->message ? entry->message : "no message";
+    switch(entry->status) {
+      case IC_STATUS_WARN:
+        ERROR_PRINT("%s: %s\n", entry->name, message);
+        break;
+      case IC_STATUS_DISABLE:
+        DEBUG_PRINT("Disabling %s: %s\n", entry->name, message);
+        entry->disabled = true;
+        break;
+      case IC_STATUS_FAIL:
+        ERROR_PRINT("%s failed: %s\n", entry->name, message);
+        failures++;
+        break;
+      default:
+        break;
+    }
+  }
+  pthread_mutex_unlock(&status_lock);
+
+  if(failures > 0) {
+    char reason[64];
+    snprintf(reason, sizeof(reason), "%d failed check%s", failures, failures > 1 ? "s" : "");
+    if(ic_failure_handler) {
+      ic_failure_handler(reason);
+      return;
+    }
+    ic_kill_job(reason);
+  }
+}
+
+// Load and initialize every plugin not marked lazy, called when this process starts running callbacks
+void ic_plugins_init(void) {
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    if(!entry->lazy) {
+      ic_plugin_prepare(entry);
+    }
+  }
+
+  ic_process_statuses();
+}
+
+// Run the finalize hook of every initialized plugin and unload its library
+// A plugin stuck in a tick is left alone
+void ic_plugins_finalize(void) {
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    if(entry->running) {
+      continue;
+    }
+
+    if(entry->isolate) {
+      ic_helper_stop(entry);
+      continue;
+    }
+
+    if(entry->initialized && entry->plugin->finalize) {
+      DEBUG_PRINT("Finalizing %s\n", entry->name);
+      entry->plugin->finalize(entry->plugin_data);
+    }
+    entry->initialized = false;
+
+    if(entry->library_handle) {
+      dlclose(entry->library_handle);
+      entry->library_handle = NULL;
+      entry->plugin = NULL;
+      entry->callback = NULL;
+    }
+  }
+}
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "IntervalCheckInternal.h"
+
+// Statistical profiler, enabled by IC_PROFILE=hz
+// Every application thread gets a timer on its own CPU time clock that sends it SIGPROF hz times a
+// second of CPU it uses, so idle threads cost nothing. The handler walks the frame pointer chain
+// from the interrupted context and counts the stack in a preallocated open addressing table, claimed
+// with a compare and swap, so it takes no locks and doesn't allocate. A background thread picks up
+// new threads from /proc/self/task. At IC_finalize the stacks are written as collapsed stacks, one
+// "program;outermost;...;innermost count" line each, ready for flamegraph.pl.
+
+// Power of two, at 280 bytes a stack the table reserves 4.5MB, touched only as stacks are seen
+#define PROFILE_TABLE_SIZE 16384
+#define PROFILE_MAX_PROBES 64
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_SCAN_INTERVAL_MS 1000
+
+// Largest frame the unwinder steps over, larger steps are taken as a corrupt chain
+#define PROFILE_MAX_FRAME (1 << 20)
+
+// glibc only names the SIGEV_THREAD_ID target from 2.35
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct {
+  _Atomic uint64_t hash;  // 0 while the slot is free
+  _Atomic uint64_t count;
+  atomic_bool ready;      // Set once frames and depth are written
+  uint32_t depth;
+  uintptr_t frames[PROFILE_MAX_DEPTH]; // Innermost first, the interrupted pc then return addresses
+} ic_profile_stack_t;
+
+// Timer of one application thread
+typedef struct {
+  pid_t tid;
+  timer_t timer;
+  bool seen; // Found by the current scan
+} ic_profile_thread_t;
+
+static ic_profile_stack_t *table = NULL;
+static bool profiling = false;
+static _Atomic uint64_t dropped = 0;
+static atomic_bool sampling = false;
+static bool safe_reads = true; // process_vm_readv is usable, otherwise only the pc is recorded
+
+static uint64_t profile_period = 0;
+static char *profile_path = NULL;
+static pid_t profile_pid = 0;
+static pthread_t scan_thread;
+static int scan_wake_fd = -1;
+
+static ic_profile_thread_t *threads = NULL;
+static size_t thread_count = 0;
+
+// Read a frame record without faulting on a corrupt chain, code built without frame pointers
+// leaves anything in the frame pointer register
+static bool read_frame(uintptr_t fp, uintptr_t frame[2]) {
+  struct iovec local = { frame, 2*sizeof(uintptr_t) };
+  struct iovec remote = { (void*)fp, 2*sizeof(uintptr_t) };
+  return syscall(SYS_process_vm_readv, profile_pid, &local, 1, &remote, 1, 0) == (ssize_t)(2*sizeof(uintptr_t));
+}
+
+static int unwind(const ucontext_t *context, uintptr_t *frames) {
+#if defined(__x86_64__)
+  uintptr_t pc = (uintptr_t)context->uc_mcontext.gregs[REG_RIP];
+  uintptr_t fp = (uintptr_t)context->uc_mcontext.gregs[REG_RBP];
+  uintptr_t sp = (uintptr_t)context->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+  uintptr_t pc = (uintptr_t)context->uc_mcontext.pc;
+  uintptr_t fp = (uintptr_t)context->uc_mcontext.regs[29];
+  uintptr_t sp = (uintptr_t)context->uc_mcontext.sp;
+#else
+  uintptr_t pc = 0, fp = 0, sp = 0;
+#endif
+  int depth = 0;
+  frames[depth++] = pc;
+  if(!safe_reads) {
+    return depth;
+  }
+
+  // The chain must stay on this stack, growing towards its base one frame at a time
+  uintptr_t lowest = sp;
+  while(depth < PROFILE_MAX_DEPTH && fp >= lowest && fp - lowest < PROFILE_MAX_FRAME && fp % sizeof(uintptr_t) == 0) {
+    uintptr_t frame[2];
+    if(!read_frame(fp, frame) || frame[1] == 0) {
+      break;
+    }
+    frames[depth++] = frame[1];
+    lowest = fp + 2*sizeof(uintptr_t);
+    fp = frame[0];
+  }
+  return depth;
+}
+
+static uint64_t hash_frames(const uintptr_t *frames, int depth) {
+  // FNV-1a over the addresses, never 0 so that 0 can mark a free slot
+  uint64_t hash = 14695981039346656037ULL;
+  for(int i=0; i<depth; i++) {
+    hash = (hash ^ (uint64_t)frames[i]) * 1099511628211ULL;
+  }
+  return hash | 1;
+}
+
+static void record_stack(const uintptr_t *frames, int depth) {
+  uint64_t hash = hash_frames(frames, depth);
+  for(int probe=0; probe<PROFILE_MAX_PROBES; probe++) {
+    ic_profile_stack_t *slot = &table[(hash + probe) & (PROFILE_TABLE_SIZE - 1)];
+    uint64_t current = atomic_load_explicit(&slot->hash, memory_order_relaxed);
+    if(current == 0) {
+      if(atomic_compare_exchange_strong_explicit(&slot->hash, &current, hash, memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+        memcpy(slot->frames, frames, depth * sizeof(uintptr_t));
+        slot->depth = (uint32_t)depth;
+        atomic_store_explicit(&slot->ready, true, memory_order_release);
+        atomic_fetch_add_explicit(&slot->count, 1, memory_order_relaxed);
+        return;
+      }
+      // Lost the race, current now holds the winner's hash
+    }
+    if(current == hash) {
+      atomic_fetch_add_explicit(&slot->count, 1, memory_order_relaxed);
+      return;
+    }
+  }
+  atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+}
+
+static void profile_handler(int sig, siginfo_t *info, void *context) {
+  if(!atomic_load_explicit(&sampling, memory_order_relaxed)) {
+    return;
+  }
+  int saved_errno = errno;
+  uintptr_t frames[PROFILE_MAX_DEPTH];
+  int depth = unwind(context, frames);
+  record_stack(frames, depth);
+  errno = saved_errno;
+}
+
+// Start sampling tid on its CPU time clock, the clock id pthread_getcpuclockid would give it
+static void add_thread(pid_t tid) {
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = tid;
+
+  clockid_t clock = (clockid_t)((~(unsigned int)tid << 3) | 6);
+  timer_t timer;
+  if(timer_create(clock, &event, &timer) != 0) {
+    // The thread may have exited since the scan
+    DEBUG_PRINT("Failed to create profiling timer for thread %d: %s\n", (int)tid, strerror(errno));
+    return;
+  }
+  struct itimerspec interval = { { profile_period / NSEC_PER_SEC, profile_period % NSEC_PER_SEC },
+                                 { profile_period / NSEC_PER_SEC, profile_period % NSEC_PER_SEC } };
+  timer_settime(timer, 0, &interval, NULL);
+
+  ic_profile_thread_t *grown = realloc(threads, (thread_count + 1) * sizeof(ic_profile_thread_t));
+  if(grown == NULL) {
+    timer_delete(timer);
+    return;
+  }
+  threads = grown;
+  threads[thread_count++] = (ic_profile_thread_t){ tid, timer, true };
+}
+
+// Add a timer for every new thread and drop the timers of threads that have exited
+static void scan_threads() {
+  DIR *tasks = opendir("/proc/self/task");
+  if(tasks == NULL) {
+    return;
+  }
+  for(size_t i=0; i<thread_count; i++) {
+    threads[i].seen = false;
+  }
+
+  pid_t self = (pid_t)syscall(SYS_gettid);
+  struct dirent *task;
+  while((task = readdir(tasks))) {
+    pid_t tid = (pid_t)atoi(task->d_name);
+    if(tid <= 0 || tid == self) {
+      continue;
+    }
+    bool known = false;
+    for(size_t i=0; i<thread_count && !known; i++) {
+      if(threads[i].tid == tid) {
+        threads[i].seen = known = true;
+      }
+    }
+    if(!known) {
+      add_thread(tid);
+    }
+  }
+  closedir(tasks);
+
+  size_t kept = 0;
+  for(size_t i=0; i<thread_count; i++) {
+    if(threads[i].seen) {
+      threads[kept++] = threads[i];
+    } else {
+      timer_delete(threads[i].timer);
+    }
+  }
+  thread_count = kept;
+}
+
+static void *scan_main(void *arg) {
+  ic_affinity_apply();
+
+  struct pollfd wake = { scan_wake_fd, POLLIN, 0 };
+  while(true) {
+    scan_threads();
+    int ready = poll(&wake, 1, PROFILE_SCAN_INTERVAL_MS);
+    if(ready != 0 && !(ready == -1 && errno == EINTR)) {
+      break;
+    }
+  }
+
+  for(size_t i=0; i<thread_count; i++) {
+    timer_delete(threads[i].timer);
+  }
+  free(threads);
+  threads = NULL;
+  thread_count = 0;
+  return NULL;
+}
+
+// Install the handler and start the thread scanner, hz samples per second of CPU time a thread uses
+// path may contain %h for the host name and %p for the pid
+void ic_profile_start(unsigned long hz, const char *path) {
+  struct sigaction action, old_action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &profile_handler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGPROF, NULL, &old_action) == 0 && old_action.sa_handler != SIG_DFL && old_action.sa_handler != SIG_IGN) {
+    ERROR_PRINT("SIGPROF handler already set, not profiling\n");
+    return;
+  }
+
+  table = mmap(NULL, PROFILE_TABLE_SIZE * sizeof(ic_profile_stack_t), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(table == MAP_FAILED) {
+    table = NULL;
+    EXIT_PRINT("Failed to allocate profile table: %s\n", strerror(errno));
+  }
+  profile_pid = getpid();
+  profile_period = NSEC_PER_SEC / hz;
+  profile_path = ic_expand_path(path);
+
+  // Seccomp or ptrace policies may forbid reading our own memory this way
+  uintptr_t probe[2] = { 1, 2 }, frame[2];
+  safe_reads = read_frame((uintptr_t)probe, frame);
+  if(!safe_reads) {
+    ERROR_PRINT("process_vm_readv unavailable, profiling without stacks: %s\n", strerror(errno));
+  }
+
+  if(sigaction(SIGPROF, &action, NULL) != 0) {
+    EXIT_PRINT("Failed to set SIGPROF handler: %s\n", strerror(errno));
+  }
+  atomic_store(&sampling, true);
+  profiling = true;
+
+  scan_wake_fd = eventfd(0, EFD_CLOEXEC);
+  if(scan_wake_fd == -1) {
+    EXIT_PRINT("Failed to create eventfd: %s\n", strerror(errno));
+  }
+
+  // Block all signals in the scanner so it isn't sampled and signals still reach the application
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  int err = pthread_create(&scan_thread, NULL, scan_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if(err != 0) {
+    EXIT_PRINT("Failed to create profiler thread: %s\n", strerror(err));
+  }
+  DEBUG_PRINT("Profiling at %luHz to %s\n", hz, profile_path);
+}
+
+// Symbol of a code address, address is a return address unless it is the interrupted pc
+static void write_frame(FILE *out, uintptr_t address, bool interrupted) {
+  // A return address may be just past the end of its caller
+  uintptr_t lookup = interrupted ? address : address - 1;
+  Dl_info info;
+  if(!dladdr((void*)lookup, &info)) {
+    fprintf(out, "0x%lx", (unsigned long)lookup);
+  } else if(info.dli_sname) {
+    fputs(info.dli_sname, out);
+  } else {
+    // Static functions have no dynamic symbol, leave an offset for addr2line
+    const char *object = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+    fprintf(out, "%s+0x%lx", *object ? object : "?", (unsigned long)(lookup - (uintptr_t)info.dli_fbase));
+  }
+}
+
+typedef struct {
+  char *stack;
+  uint64_t count;
+} ic_profile_line_t;
+
+static int compare_lines(const void *a, const void *b) {
+  return strcmp(((const ic_profile_line_t*)a)->stack, ((const ic_profile_line_t*)b)->stack);
+}
+
+// Stop sampling and write the collapsed stacks
+void ic_profile_stop(void) {
+  if(!profiling) {
+    return;
+  }
+  profiling = false;
+
+  uint64_t wake = 1;
+  if(write(scan_wake_fd, &wake, sizeof(wake)) == sizeof(wake)) {
+    pthread_join(scan_thread, NULL);
+  }
+  close(scan_wake_fd);
+  scan_wake_fd = -1;
+  atomic_store(&sampling, false);
+
+  // Stacks that differ only in the pc within the innermost function collapse to the same line
+  size_t count = 0;
+  ic_profile_line_t *lines = NULL;
+  for(size_t i=0; i<PROFILE_TABLE_SIZE; i++) {
+    ic_profile_stack_t *slot = &table[i];
+    // A handler interrupted before publishing the frames leaves its stack out
+    if(!atomic_load_explicit(&slot->ready, memory_order_acquire)) {
+      continue;
+    }
+    ic_profile_line_t *grown = realloc(lines, (count + 1) * sizeof(ic_profile_line_t));
+    if(grown == NULL) {
+      break;
+    }
+    lines = grown;
+
+    size_t size;
+    FILE *line = open_memstream(&lines[count].stack, &size);
+    if(line == NULL) {
+      break;
+    }
+    fputs(program_invocation_short_name, line);
+    for(int frame=(int)slot->depth-1; frame>=0; frame--) {
+      fputc(';', line);
+      write_frame(line, slot->frames[frame], frame == 0);
+    }
+    fclose(line);
+    lines[count++].count = atomic_load(&slot->count);
+  }
+  qsort(lines, count, sizeof(ic_profile_line_t), compare_lines);
+
+  FILE *out = fopen(profile_path, "w");
+  if(out == NULL) {
+    ERROR_PRINT("Failed to write profile %s: %s\n", profile_path, strerror(errno));
+  } else {
+    uint64_t samples = 0;
+    for(size_t i=0; i<count; i++) {
+      if(i + 1 < count && strcmp(lines[i].stack, lines[i+1].stack) == 0) {
+        lines[i+1].count += lines[i].count;
+        continue;
+      }
+      samples += lines[i].count;
+      fprintf(out, "%s %llu\n", lines[i].stack, (unsigned long long)lines[i].count);
+    }
+    if(atomic_load(&dropped) > 0) {
+      fprintf(out, "%s;[dropped] %llu\n", program_invocation_short_name, (unsigned long long)atomic_load(&dropped));
+    }
+    fclose(out);
+    DEBUG_PRINT("Wrote %llu samples to %s\n", (unsigned long long)samples, profile_path);
+  }
+  for(size_t i=0; i<count; i++) {
+    free(lines[i].stack);
+  }
+  free(lines);
+
+  // Leave the handler and table in place, a signal already pending must still find them
+  free(profile_path);
+  profile_path = NULL;
+}
+
+// Called in a forked child, which inherits no timers and must not write the parent's profile
+void ic_profile_detach(void) {
+  atomic_store(&sampling, false);
+  profiling = false;
+  threads = NULL;
+  thread_count = 0;
+  if(scan_wake_fd != -1) {
+    close(scan_wake_fd);
+    scan_wake_fd = -1;
+  }
+}
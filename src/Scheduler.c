@@ -0,0 +1,328 @@
+#include <time.h>
+#include <errno.h>
+#include "IntervalCheckInternal.h"
+
+// Every callback carries its own period and initial delay. Pending deadlines are kept in a
+// single binary min-heap so the timer only needs to be armed for the earliest one.
+
+ic_entry_t ic_entries[MAX_CALLBACKS];
+int ic_entry_count = 0;
+
+double ic_max_overhead = 0;
+uint64_t ic_min_interval = NSEC_PER_SEC;
+uint64_t ic_max_interval = 0;
+
+// Periods are only changed when the target differs by more than this fraction
+#define IC_ADAPT_HYSTERESIS 0.05
+
+// Heap of indices into ic_entries ordered by deadline
+static int heap[MAX_CALLBACKS];
+static int heap_size = 0;
+
+static uint64_t monotonic_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+// Every time the scheduler, worker pool and plugin ticks see comes from this clock
+static ic_clock_t clock_now = monotonic_now;
+
+// Replace the clock, e.g. with the virtual clock of ic_replay, NULL restores CLOCK_MONOTONIC
+void ic_set_clock(ic_clock_t clock) {
+  clock_now = clock ? clock : monotonic_now;
+}
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t ic_now(void) {
+  return clock_now();
+}
+
+// Parse a duration such as "250ms", "30s", "5m" or "1.5h" into nanoseconds
+// A bare number is taken as seconds to remain compatible with IC_INTERVAL
+bool ic_parse_duration(const char *str, uint64_t *ns) {
+  char *unit;
+  errno = 0;
+  double value = strtod(str, &unit);
+  if(unit == str || errno != 0 || value < 0) {
+    return false;
+  }
+
+  double scale;
+  if(*unit == '\0' || strcmp(unit, "s") == 0) {
+    scale = 1e9;
+  } else if(strcmp(unit, "ns") == 0) {
+    scale = 1.0;
+  } else if(strcmp(unit, "us") == 0) {
+    scale = 1e3;
+  } else if(strcmp(unit, "ms") == 0) {
+    scale = 1e6;
+  } else if(strcmp(unit, "m") == 0) {
+    scale = 60e9;
+  } else if(strcmp(unit, "h") == 0) {
+    scale = 3600e9;
+  } else {
+    return false;
+  }
+
+  *ns = (uint64_t)(value * scale);
+  return true;
+}
+
+// Parse a single IC_CALLBACKS entry of the form name[@period[+delay]][!option[=value]...]
+// e.g. "gpu_health@30s", "file_progress@5m+10m", "foo@1m!timeout=20s", "gpu_health!lazy" or "gpu_health!isolate"
+// The callback itself is resolved by the caller
+ic_entry_t *ic_add_entry(const char *spec, uint64_t default_period) {
+  if(ic_entry_count == MAX_CALLBACKS) {
+    EXIT_PRINT("Callback count exceeded: %d\n", MAX_CALLBACKS);
+  }
+
+  char buffer[IC_MAX_NAME_LENGTH];
+  if(strlen(spec) >= IC_MAX_NAME_LENGTH) {
+    EXIT_PRINT("Callback specification too long: %s\n", spec);
+  }
+  strcpy(buffer, spec);
+
+  ic_entry_t *entry = &ic_entries[ic_entry_count];
+  memset(entry, 0, sizeof(*entry));
+  entry->period = default_period;
+  entry->delay = 0;
+  entry->helper_fd = -1;
+
+  char *options = strchr(buffer, '!');
+  if(options) {
+    *options++ = '\0';
+  }
+
+  char *option;
+  while(options && (option = strsep(&options, "!"))) {
+    if(strncmp(option, "timeout=", 8) == 0) {
+      if(!ic_parse_duration(option + 8, &entry->timeout)) {
+        EXIT_PRINT("Invalid timeout for %s: %s\n", buffer, option + 8);
+      }
+    } else if(strcmp(option, "lazy") == 0) {
+      entry->lazy = true;
+    } else if(strcmp(option, "isolate") == 0) {
+      entry->isolate = true;
+    } else {
+      EXIT_PRINT("Unknown option for %s: %s\n", buffer, option);
+    }
+  }
+
+  char *schedule = strchr(buffer, '@');
+  if(schedule) {
+    *schedule++ = '\0';
+
+    char *delay = strchr(schedule, '+');
+    if(delay) {
+      *delay++ = '\0';
+      if(!ic_parse_duration(delay, &entry->delay)) {
+        EXIT_PRINT("Invalid delay for %s: %s\n", buffer, delay);
+      }
+    }
+
+    if(*schedule != '\0') {
+      if(!ic_parse_duration(schedule, &entry->period)) {
+        EXIT_PRINT("Invalid period for %s: %s\n", buffer, schedule);
+      }
+      entry->fixed_period = true;
+    }
+  }
+
+  if(entry->period == 0) {
+    EXIT_PRINT("Period for %s must be greater than zero\n", buffer);
+  }
+
+  strcpy(entry->name, buffer);
+  ic_entry_count++;
+
+  return entry;
+}
+
+static bool heap_less(int a, int b) {
+  return ic_entries[heap[a]].deadline < ic_entries[heap[b]].deadline;
+}
+
+static void heap_swap(int a, int b) {
+  int tmp = heap[a];
+  heap[a] = heap[b];
+  heap[b] = tmp;
+}
+
+static void heap_sift_up(int i) {
+  while(i > 0 && heap_less(i, (i-1)/2)) {
+    heap_swap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void heap_push(int entry_index) {
+  heap[heap_size] = entry_index;
+  heap_sift_up(heap_size++);
+}
+
+// Restore the heap order after the deadline of entry_index moved earlier
+static void heap_decrease(int entry_index) {
+  for(int i=0; i<heap_size; i++) {
+    if(heap[i] == entry_index) {
+      heap_sift_up(i);
+      return;
+    }
+  }
+}
+
+static int heap_pop() {
+  int top = heap[0];
+  heap[0] = heap[--heap_size];
+
+  int i = 0;
+  while(true) {
+    int smallest = i;
+    int left = 2*i + 1;
+    int right = 2*i + 2;
+    if(left < heap_size && heap_less(left, smallest)) {
+      smallest = left;
+    }
+    if(right < heap_size && heap_less(right, smallest)) {
+      smallest = right;
+    }
+    if(smallest == i) {
+      break;
+    }
+    heap_swap(i, smallest);
+    i = smallest;
+  }
+
+  return top;
+}
+
+// Set the initial deadline of every entry relative to now
+void ic_schedule_start(uint64_t now) {
+  heap_size = 0;
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entries[i].deadline = now + ic_entries[i].delay;
+    ic_entries[i].last_dispatch = 0;
+    heap_push(i);
+  }
+}
+
+// Absolute time the timer should next fire, IC_NO_DEADLINE if nothing is scheduled
+uint64_t ic_next_deadline(void) {
+  if(heap_size == 0) {
+    return IC_NO_DEADLINE;
+  }
+  return ic_entries[heap[0]].deadline;
+}
+
+// Fold a call's execution time into the entry's moving average cost
+// Returns true for the first call measured
+bool ic_record_cost(ic_entry_t *entry, uint64_t elapsed) {
+  uint64_t cost = __atomic_load_n(&entry->cost, __ATOMIC_RELAXED);
+  bool first = cost == 0;
+  cost = first ? elapsed : (3*cost + elapsed) / 4;
+  __atomic_store_n(&entry->cost, cost, __ATOMIC_RELAXED);
+  return first;
+}
+
+// Fit the periods of adaptive entries to the overhead budget
+// The duty cycle of an entry is cost/period. Fixed period entries use their share of the budget
+// first, the rest is split evenly so every adaptive entry gets the shortest period the budget
+// allows. Entries that would drop below ic_min_interval are held there and their unused share
+// handed to the others. An entry keeps its configured period until its first call has been
+// measured, a cost of 0 would otherwise send it straight to ic_min_interval. A shorter period
+// applies to the pending call too, rather than only after a full old period.
+static void adapt_periods() {
+  double budget = ic_max_overhead;
+  bool settled[MAX_CALLBACKS];
+  bool unmeasured[MAX_CALLBACKS];
+  int remaining = 0;
+
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    uint64_t cost = __atomic_load_n(&entry->cost, __ATOMIC_RELAXED);
+    unmeasured[i] = !entry->fixed_period && cost == 0;
+    settled[i] = entry->fixed_period || unmeasured[i];
+    if(entry->fixed_period) {
+      budget -= (double)cost / entry->period;
+    } else if(!unmeasured[i]) {
+      remaining++;
+    }
+  }
+
+  double target[MAX_CALLBACKS];
+  bool changed = true;
+  while(changed && remaining > 0) {
+    changed = false;
+    for(int i=0; i<ic_entry_count; i++) {
+      if(settled[i]) {
+        continue;
+      }
+      uint64_t cost = __atomic_load_n(&ic_entries[i].cost, __ATOMIC_RELAXED);
+      target[i] = budget > 0 ? (double)cost * remaining / budget : (double)ic_max_interval;
+      if(target[i] < ic_min_interval) {
+        target[i] = ic_min_interval;
+        budget -= (double)cost / ic_min_interval;
+        settled[i] = true;
+        remaining--;
+        changed = true;
+      }
+    }
+  }
+
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    if(entry->fixed_period || unmeasured[i]) {
+      continue;
+    }
+
+    uint64_t period = target[i] > ic_max_interval ? ic_max_interval : (uint64_t)target[i];
+    double difference = (double)period - entry->period;
+    if(difference > IC_ADAPT_HYSTERESIS * entry->period || -difference > IC_ADAPT_HYSTERESIS * entry->period) {
+      ic_event(IC_EVENT_PERIOD, (uint16_t)i, 0, period);
+      entry->period = period;
+      entry->adjustments++;
+      if(entry->last_dispatch > 0 && entry->last_dispatch + period < entry->deadline) {
+        entry->deadline = entry->last_dispatch + period;
+        heap_decrease(i);
+      }
+    }
+  }
+}
+
+// Refit the adaptive periods to the costs measured so far
+void ic_refit_periods(void) {
+  if(ic_max_overhead > 0) {
+    adapt_periods();
+  }
+}
+
+// Dispatch every entry whose deadline has passed and schedule its next call
+void ic_run_due(uint64_t now) {
+  while(heap_size > 0 && ic_entries[heap[0]].deadline <= now) {
+    int index = heap_pop();
+    ic_entry_t *entry = &ic_entries[index];
+
+    // A disabled entry is simply not rescheduled
+    if(entry->disabled) {
+      continue;
+    }
+
+    ic_stats_record_jitter(entry, now - entry->deadline);
+    ic_event(IC_EVENT_DISPATCH, (uint16_t)index, 0, now - entry->deadline);
+    entry->last_dispatch = now;
+    ic_dispatch(entry);
+
+    // Keep the original phase, skipping any periods that were missed entirely
+    entry->deadline += entry->period;
+    if(entry->deadline <= now) {
+      uint64_t missed = (now - entry->deadline) / entry->period + 1;
+      entry->deadline += missed * entry->period;
+    }
+    heap_push(index);
+  }
+
+  // Refit once per round, after the calls run inline have been measured
+  ic_refit_periods();
+
+  ic_process_statuses();
+}
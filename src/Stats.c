@@ -0,0 +1,229 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "IntervalCheckInternal.h"
+
+// Per callback execution time, timer jitter and application cpu time taken
+// Each is kept in a fixed size log-linear histogram: values below 2^IC_HIST_SUB_BITS ns have
+// their own bucket, above that every power of two is split into IC_HIST_SUB_COUNT buckets,
+// giving roughly 6% precision from nanoseconds up to an hour with no allocation while recording.
+// Each histogram has a single writer, the worker running the callback or the scheduler, so
+// recording is plain arithmetic and safe from the SIGALRM handler.
+
+#define IC_HIST_SUB_BITS 4
+#define IC_HIST_SUB_COUNT (1 << IC_HIST_SUB_BITS)
+#define IC_HIST_MAX_BITS 42
+#define IC_HIST_MAX_VALUE ((1ULL << IC_HIST_MAX_BITS) - 1)
+#define IC_HIST_BUCKETS ((IC_HIST_MAX_BITS - IC_HIST_SUB_BITS + 1) * IC_HIST_SUB_COUNT)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint32_t buckets[IC_HIST_BUCKETS];
+} ic_histogram_t;
+
+struct ic_entry_stats {
+  ic_histogram_t exec;   // Time spent in the callback
+  ic_histogram_t jitter; // Time between the deadline and the scheduler dispatching the callback
+  ic_histogram_t stolen; // CPU time each call used on application cpus
+};
+
+static char *stats_path = NULL;
+
+static int bucket_index(uint64_t value) {
+  if(value > IC_HIST_MAX_VALUE) {
+    value = IC_HIST_MAX_VALUE;
+  }
+  if(value < IC_HIST_SUB_COUNT) {
+    return (int)value;
+  }
+  int magnitude = 63 - __builtin_clzll(value);
+  int sub = (int)(value >> (magnitude - IC_HIST_SUB_BITS)) & (IC_HIST_SUB_COUNT - 1);
+  return (magnitude - IC_HIST_SUB_BITS + 1) * IC_HIST_SUB_COUNT + sub;
+}
+
+// Midpoint of the values that fall in bucket index
+static uint64_t bucket_value(int index) {
+  int row = index / IC_HIST_SUB_COUNT;
+  uint64_t sub = index % IC_HIST_SUB_COUNT;
+  if(row == 0) {
+    return sub;
+  }
+  int shift = row - 1;
+  uint64_t lower = (IC_HIST_SUB_COUNT + sub) << shift;
+  return lower + ((1ULL << shift) >> 1);
+}
+
+static void record(ic_histogram_t *hist, uint64_t value) {
+  if(hist->count == 0 || value < hist->min) {
+    hist->min = value;
+  }
+  if(value > hist->max) {
+    hist->max = value;
+  }
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[bucket_index(value)]++;
+}
+
+static uint64_t percentile(const ic_histogram_t *hist, double fraction) {
+  if(hist->count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(fraction * (double)(hist->count - 1)) + 1;
+  uint64_t seen = 0;
+  for(int i=0; i<IC_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if(seen >= rank) {
+      uint64_t value = bucket_value(i);
+      // The bucket midpoint can fall outside the values actually recorded
+      if(value < hist->min) {
+        return hist->min;
+      }
+      return value > hist->max ? hist->max : value;
+    }
+  }
+  return hist->max;
+}
+
+void ic_stats_record_exec(ic_entry_t *entry, uint64_t elapsed) {
+  if(entry->stats) {
+    record(&entry->stats->exec, elapsed);
+  }
+}
+
+void ic_stats_record_jitter(ic_entry_t *entry, uint64_t lateness) {
+  if(entry->stats) {
+    record(&entry->stats->jitter, lateness);
+  }
+}
+
+void ic_stats_record_stolen(ic_entry_t *entry, uint64_t stolen) {
+  if(entry->stats) {
+    record(&entry->stats->stolen, stolen);
+  }
+}
+
+// Expand %h to the host name and %p to the pid in pattern, the result is allocated with malloc
+char *ic_expand_path(const char *pattern) {
+  char host[256] = "unknown";
+  gethostname(host, sizeof(host));
+  host[sizeof(host)-1] = '\0';
+
+  size_t length = strlen(pattern) + 1;
+  for(const char *c = pattern; *c; c++) {
+    if(*c == '%') {
+      length += sizeof(host) + 16;
+    }
+  }
+  char *path = malloc(length);
+  if(path == NULL) {
+    EXIT_PRINT("Failed to allocate path for %s\n", pattern);
+  }
+
+  char *out = path;
+  for(const char *c = pattern; *c; c++) {
+    if(c[0] == '%' && c[1] == 'h') {
+      out += sprintf(out, "%s", host);
+      c++;
+    } else if(c[0] == '%' && c[1] == 'p') {
+      out += sprintf(out, "%d", (int)getpid());
+      c++;
+    } else {
+      *out++ = *c;
+    }
+  }
+  *out = '\0';
+  return path;
+}
+
+// Enable statistics for every entry, path may contain %h for the host name and %p for the pid
+void ic_stats_init(const char *path) {
+  stats_path = ic_expand_path(path);
+
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entries[i].stats = calloc(1, sizeof(ic_entry_stats_t));
+    if(ic_entries[i].stats == NULL) {
+      EXIT_PRINT("Failed to allocate statistics for %s\n", ic_entries[i].name);
+    }
+  }
+}
+
+static void write_json_histogram(FILE *file, const char *name, const ic_histogram_t *hist) {
+  fprintf(file, "\"%s\":{\"count\":%llu,\"min\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+          name, (unsigned long long)hist->count, (unsigned long long)hist->min,
+          (unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+          (unsigned long long)percentile(hist, 0.50), (unsigned long long)percentile(hist, 0.90),
+          (unsigned long long)percentile(hist, 0.99), (unsigned long long)hist->max);
+}
+
+static void write_json(FILE *file) {
+  char host[256] = "unknown";
+  gethostname(host, sizeof(host));
+  host[sizeof(host)-1] = '\0';
+
+  fprintf(file, "{\"host\":\"%s\",\"pid\":%d,\"callbacks\":[", host, (int)getpid());
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    fprintf(file, "%s\n{\"name\":\"%s\",\"period_ns\":%llu,\"cost_ns\":%llu,\"adjustments\":%lu,\"skips\":%lu,\"overruns\":%lu,",
+            i ? "," : "", entry->name, (unsigned long long)entry->period, (unsigned long long)entry->cost,
+            entry->adjustments, entry->skips, entry->overruns);
+    write_json_histogram(file, "exec_ns", &entry->stats->exec);
+    fprintf(file, ",");
+    write_json_histogram(file, "jitter_ns", &entry->stats->jitter);
+    fprintf(file, ",");
+    write_json_histogram(file, "stolen_ns", &entry->stats->stolen);
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n]}\n");
+}
+
+static void write_csv_histogram(FILE *file, const ic_entry_t *entry, const char *metric, const ic_histogram_t *hist) {
+  fprintf(file, "%s,%s,%llu,%llu,%lu,%llu,%lu,%lu,%llu,%llu,%llu,%llu,%llu,%llu\n", entry->name, metric,
+          (unsigned long long)entry->period, (unsigned long long)entry->cost, entry->adjustments,
+          (unsigned long long)hist->count, entry->skips, entry->overruns, (unsigned long long)hist->min,
+          (unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+          (unsigned long long)percentile(hist, 0.50), (unsigned long long)percentile(hist, 0.90),
+          (unsigned long long)percentile(hist, 0.99), (unsigned long long)hist->max);
+}
+
+static void write_csv(FILE *file) {
+  fprintf(file, "callback,metric,period_ns,cost_ns,adjustments,count,skips,overruns,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+  for(int i=0; i<ic_entry_count; i++) {
+    write_csv_histogram(file, &ic_entries[i], "exec", &ic_entries[i].stats->exec);
+    write_csv_histogram(file, &ic_entries[i], "jitter", &ic_entries[i].stats->jitter);
+    write_csv_histogram(file, &ic_entries[i], "stolen", &ic_entries[i].stats->stolen);
+  }
+}
+
+// Write the summary, CSV if the path ends in .csv and JSON otherwise
+// The file is replaced atomically so a periodic write never leaves a partial summary
+void ic_stats_write(void) {
+  if(stats_path == NULL) {
+    return;
+  }
+
+  char tmp_path[strlen(stats_path) + 8];
+  sprintf(tmp_path, "%s.tmp", stats_path);
+
+  FILE *file = fopen(tmp_path, "w");
+  if(file == NULL) {
+    ERROR_PRINT("Failed to open %s: %s\n", tmp_path, strerror(errno));
+    return;
+  }
+
+  size_t length = strlen(stats_path);
+  if(length > 4 && strcmp(stats_path + length - 4, ".csv") == 0) {
+    write_csv(file);
+  } else {
+    write_json(file);
+  }
+
+  if(fclose(file) != 0 || rename(tmp_path, stats_path) != 0) {
+    ERROR_PRINT("Failed to write %s: %s\n", stats_path, strerror(errno));
+  }
+}
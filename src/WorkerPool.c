@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "IntervalCheckInternal.h"
+
+// Bounded pool of worker threads used in IC_MODE_THREAD
+// Due callbacks are queued by the monitor thread and run concurrently so a single slow check
+// only delays itself. With no workers, as in IC_MODE_SIGNAL, callbacks run inline.
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[IC_MAX_WORKERS];
+static int pool_size = 0;
+static bool pool_shutdown = false;
+
+// Ring buffer of queued entries, an entry is never queued twice so MAX_CALLBACKS is sufficient
+static ic_entry_t *queue[MAX_CALLBACKS];
+static int queue_head = 0;
+static int queue_count = 0;
+
+// How long IC_finalize waits for busy workers before abandoning them
+#define POOL_STOP_GRACE_NS (1*NSEC_PER_SEC)
+
+// Run the callback, reporting the overrun on return if it wasn't already caught by ic_check_timeouts
+// The deadline is measured from dispatch so time spent waiting for a free worker counts against it
+static void execute(ic_entry_t *entry) {
+  uint64_t start = entry->started;
+
+  uint16_t id = (uint16_t)(entry - ic_entries);
+  ic_status_t status = IC_STATUS_OK;
+
+  ic_noise_probe_t noise;
+  ic_noise_begin(&noise);
+  uint64_t begin = ic_now();
+  ic_event_log_set_entry(entry);
+  ic_event(IC_EVENT_TICK_START, id, 0, begin - start);
+  if(entry->lazy && !ic_plugin_prepare(entry)) {
+    // The plugin couldn't be loaded or initialized and has been disabled
+    status = IC_STATUS_DISABLE;
+  } else if(entry->isolate) {
+    const char *message;
+    status = ic_helper_tick(entry, begin, &message);
+    ic_record_status(entry, status, message);
+  } else if(entry->plugin) {
+    ic_tick_ctx_t ctx = { begin, entry->ticks, entry->period, entry->plugin_data, NULL };
+    status = entry->plugin->tick(&ctx);
+    ic_record_status(entry, status, ctx.message);
+  } else {
+    (*entry->callback)();
+  }
+  entry->ticks++;
+  uint64_t end = ic_now();
+  ic_event(IC_EVENT_TICK_END, id, (uint32_t)status, end - begin);
+  ic_event_log_set_entry(NULL);
+
+  uint64_t stolen = ic_noise_end(&noise);
+  entry->stolen += stolen;
+  ic_stats_record_exec(entry, end - begin);
+  ic_stats_record_stolen(entry, stolen);
+  // The monitor refits periods once per round, a first cost measured in a worker would otherwise
+  // only shorten the period after a full round at the configured one
+  if(ic_record_cost(entry, end - begin) && pool_size > 0 && ic_max_overhead > 0) {
+    ic_monitor_refit();
+  }
+  uint64_t elapsed = end - start;
+
+  if(pool_size > 0) {
+    pthread_mutex_lock(&pool_lock);
+  }
+  if(entry->timeout > 0 && elapsed > entry->timeout && !entry->overrun_reported) {
+    entry->overruns++;
+    ic_event(IC_EVENT_OVERRUN, id, 0, elapsed);
+    ERROR_PRINT("%s took %.3fs, exceeding its timeout of %.3fs\n", entry->name,
+                (double)elapsed/NSEC_PER_SEC, (double)entry->timeout/NSEC_PER_SEC);
+  }
+  entry->running = false;
+  entry->overrun_reported = false;
+  entry->started = 0;
+  if(pool_size > 0) {
+    pthread_mutex_unlock(&pool_lock);
+
+    // Without a pool statuses are processed once the whole round has run
+    ic_process_statuses();
+  }
+}
+
+static void *worker_main(void *arg) {
+  ic_affinity_apply();
+
+  pthread_mutex_lock(&pool_lock);
+  while(true) {
+    while(queue_count == 0 && !pool_shutdown) {
+      pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    if(pool_shutdown) {
+      break;
+    }
+
+    ic_entry_t *entry = queue[queue_head];
+    queue_head = (queue_head + 1) % MAX_CALLBACKS;
+    queue_count--;
+
+    pthread_mutex_unlock(&pool_lock);
+    execute(entry);
+    pthread_mutex_lock(&pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+
+  return NULL;
+}
+
+// Start worker_count threads, at most IC_MAX_WORKERS
+void ic_pool_start(int worker_count) {
+  if(worker_count > IC_MAX_WORKERS) {
+    worker_count = IC_MAX_WORKERS;
+  }
+
+  pool_shutdown = false;
+  queue_head = 0;
+  queue_count = 0;
+
+  // Workers inherit the fully blocked signal mask of the monitor thread that starts them
+  for(int i=0; i<worker_count; i++) {
+    int err = pthread_create(&workers[i], NULL, worker_main, NULL);
+    if(err != 0) {
+      EXIT_PRINT("Failed to create worker thread: %s\n", strerror(err));
+    }
+    pool_size++;
+  }
+
+  DEBUG_PRINT("Started %d workers\n", pool_size);
+}
+
+// Stop the workers, a worker stuck in a hung callback is abandoned after a short grace period
+void ic_pool_stop(void) {
+  if(pool_size == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  pool_shutdown = true;
+  pthread_cond_broadcast(&pool_cond);
+  pthread_mutex_unlock(&pool_lock);
+
+  struct timespec grace;
+  clock_gettime(CLOCK_REALTIME, &grace);
+  grace.tv_sec += POOL_STOP_GRACE_NS / NSEC_PER_SEC;
+
+  for(int i=0; i<pool_size; i++) {
+    if(pthread_equal(pthread_self(), workers[i])) {
+      continue;
+    }
+    if(pthread_timedjoin_np(workers[i], NULL, &grace) != 0) {
+      DEBUG_PRINT("WARNING: Abandoning busy worker %d\n", i);
+      pthread_detach(workers[i]);
+    }
+  }
+
+  pool_size = 0;
+}
+
+// Run entry now if there is no pool, otherwise queue it for the workers
+// An entry whose previous call is still running is skipped
+void ic_dispatch(ic_entry_t *entry) {
+  if(pool_size == 0) {
+    entry->running = true;
+    entry->started = ic_now();
+    execute(entry);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  if(entry->running) {
+    entry->skips++;
+    ic_event(IC_EVENT_SKIP, (uint16_t)(entry - ic_entries), 0, 0);
+  } else {
+    entry->running = true;
+    entry->started = ic_now();
+    queue[(queue_head + queue_count) % MAX_CALLBACKS] = entry;
+    queue_count++;
+    pthread_cond_signal(&pool_cond);
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+// Report any running callback that has exceeded its timeout
+// Returns the earliest time a running callback will time out, IC_NO_DEADLINE if none will
+uint64_t ic_check_timeouts(uint64_t now) {
+  uint64_t next = IC_NO_DEADLINE;
+  if(pool_size == 0) {
+    return next;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  for(int i=0; i<ic_entry_count; i++) {
+    ic_entry_t *entry = &ic_entries[i];
+    if(!entry->running || entry->timeout == 0 || entry->overrun_reported) {
+      continue;
+    }
+
+    uint64_t expires = entry->started + entry->timeout;
+    if(now >= expires) {
+      entry->overruns++;
+      entry->overrun_reported = true;
+      ic_event(IC_EVENT_OVERRUN, (uint16_t)i, 0, now - entry->started);
+      ERROR_PRINT("%s has been running for %.3fs, exceeding its timeout of %.3fs\n", entry->name,
+                  (double)(now - entry->started)/NSEC_PER_SEC, (double)entry->timeout/NSEC_PER_SEC);
+    } else if(expires < next) {
+      next = expires;
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+
+  return next;
+}